@@ -1,2 +1,2 @@
-pasmo -v --bin "$1" file.bin
+pasmo -v --bin "$1" file.bin file.sym
 #./pix80emu file.bin
@@ -1 +1,15 @@
-g++ pix80emu.c -o pix80emu
+# ./compile.sh [-g] [recompiled ROM from pix80emu --recompile]
+# -g builds z80_tick() with a computed goto instead of a switch, made from include/z80.h by z80goto.py
+# The LCD is built in when include/vrEmuLcd.c from https://github.com/visrealm/VrEmuLcd is there
+GOTO=
+if [ "$1" = "-g" ]; then
+	GOTO=$(mktemp --suffix=.h)
+	trap 'rm -f "$GOTO"' EXIT
+	python3 z80goto.py include/z80.h > "$GOTO" || exit 1
+	shift
+fi
+LCD=
+if [ -f include/vrEmuLcd.c ]; then
+	LCD="-DPIX80_LCD -DVR_LCD_EMU_STATIC -x c include/vrEmuLcd.c -x c++"
+fi
+g++ -O2 -pthread ${GOTO:+-DPIX80_Z80_GOTO="\"$GOTO\""} ${1:+-DPIX80_AOT="\"$(realpath "$1")\""} $LCD pix80emu.c -o pix80emu
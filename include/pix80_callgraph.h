@@ -0,0 +1,344 @@
+#pragma once
+/*
+ * Pix80 call graph profiler
+ *
+ * Which call paths the cycles went to, written as folded stacks
+ * ("reset;main;print 1234" per line) that flame graph tools take as
+ * they are.
+ *
+ * A shadow call stack follows the guest's. Nothing hooks into the
+ * CPU, every instruction boundary looks at what the last instruction
+ * did to PC and SP:
+ *
+ *   CALL, RST     SP went down by 2 and the stack holds the address
+ *                 after the instruction, a frame is pushed
+ *   RET, RETI...  SP went up by 2, the frame of that stack slot is popped
+ *   LD SP         the stack was switched
+ *
+ * Interrupts are the exception. The CPU takes them straight after an
+ * instruction, with no boundary in between, so that instruction and
+ * the interrupt's push look like one. The emulator says when one was
+ * acknowledged (callGraphInterrupt()), the address on top of the stack
+ * then is where the instruction before it went, that instruction is
+ * looked at first and the handler gets a frame of its own after it.
+ *
+ * Frames are kept with the stack slot of their return address. A
+ * return pops every frame at or below the slot it returned through
+ * and a call first drops the ones at or below its own slot, so frames
+ * the guest abandoned (a return address popped into a register, a
+ * stack reset, a RET into code that was never called) don't pile up.
+ *
+ * Code that switches stacks, like a scheduler that saves SP, loads
+ * another process' SP and RETs into it, takes its frames along:
+ * loading SP puts the shadow stack away under the SP it had and brings
+ * back the one put away under the new SP, so every process keeps its
+ * own call path. A new SP nobody put away starts with nothing called,
+ * unless it's within CALLGRAPH_STACK_REACH of the old one, that's
+ * still the same stack with room made for locals or given back.
+ *
+ * Cycles go to the node of the call tree the shadow stack is at, one
+ * add per instruction. Frames are named after the entry points: the
+ * pasmo symbol at or below them when there's a symbol file, the
+ * address otherwise, bank:address in the Banking Area.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "pix80_memory.h"
+#include "pix80_profile.h"
+
+#define CALLGRAPH_MAX_DEPTH 1024
+#define CALLGRAPH_MAX_NODES (1 << 20)
+// stacks put away at the same time
+#define CALLGRAPH_CONTEXTS 8
+// how far loading SP can move it and stay on the same stack
+#define CALLGRAPH_STACK_REACH 0x100
+// longest frame name: "int:", a profileSymbol_t name of 63 characters and "+65535"
+#define CALLGRAPH_NAME_MAX (4 + 63 + 6)
+// entry flag of nodes that are interrupt handlers
+#define CALLGRAPH_INTERRUPT 0x80000000u
+
+typedef struct {
+	uint32_t parent;
+	// 0 is none, the root is never anyone's child
+	uint32_t firstChild;
+	uint32_t nextSibling;
+	// profileIndex() of the entry point, CALLGRAPH_INTERRUPT for handlers
+	uint32_t entry;
+	uint64_t cycles;
+	uint64_t instructions;
+} callNode_t;
+
+typedef struct {
+	// where the return address is
+	uint16_t sp;
+	uint32_t node;
+} callFrame_t;
+
+typedef struct {
+	bool used;
+	uint16_t sp;
+	int depth;
+	callFrame_t frames[CALLGRAPH_MAX_DEPTH];
+} callContext_t;
+
+typedef struct {
+	callNode_t* nodes;
+	uint32_t nodeCount;
+	callFrame_t frames[CALLGRAPH_MAX_DEPTH];
+	int depth;
+	// where the cycles go, the top frame's node or the root
+	uint32_t current;
+	// the instruction that started at the last boundary
+	uint16_t lastPc;
+	uint16_t lastSp;
+	uint8_t lastOp[2];
+	uint64_t lastTicks;
+	uint64_t lastInstructions;
+	// an interrupt was acknowledged since the last boundary
+	bool interrupted;
+	callContext_t contexts[CALLGRAPH_CONTEXTS];
+	int nextContext;
+	uint64_t calls;
+	uint64_t interrupts;
+	uint64_t returns;
+	uint64_t switches;
+	// calls deeper than CALLGRAPH_MAX_DEPTH or past CALLGRAPH_MAX_NODES, counted in the caller
+	uint64_t dropped;
+} callGraph_t;
+
+extern callGraph_t callGraph;
+
+// start following calls from the CPU state at a boundary
+bool callGraphInit(uint16_t pc, uint16_t sp, uint64_t ticks, uint64_t instructions);
+// an instruction boundary, the next instruction starts at 'pc' in 'bank'
+void callGraphInstruction(uint16_t pc, uint8_t bank, uint16_t sp, uint64_t ticks, uint64_t instructions);
+// an interrupt acknowledge, the next boundary is in its handler
+static inline void callGraphInterrupt() {
+	callGraph.interrupted = true;
+}
+// write the folded stacks, 'symbolPath' may be NULL
+bool callGraphWrite(const char* path, const char* symbolPath);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+callGraph_t callGraph;
+
+bool callGraphInit(uint16_t pc, uint16_t sp, uint64_t ticks, uint64_t instructions) {
+	callGraph.nodes = (callNode_t*)malloc(CALLGRAPH_MAX_NODES * sizeof(callNode_t));
+	if (!callGraph.nodes) {
+		return false;
+	}
+	// the root, whatever runs with nothing called
+	memset(&callGraph.nodes[0], 0, sizeof(callNode_t));
+	callGraph.nodeCount = 1;
+	callGraph.depth = 0;
+	callGraph.current = 0;
+	callGraph.lastPc = pc;
+	callGraph.lastSp = sp;
+	callGraph.lastOp[0] = readMappedMemory(pc);
+	callGraph.lastOp[1] = readMappedMemory(pc + 1);
+	callGraph.lastTicks = ticks;
+	callGraph.lastInstructions = instructions;
+	callGraph.interrupted = false;
+	for (int i = 0; i < CALLGRAPH_CONTEXTS; i++) {
+		callGraph.contexts[i].used = false;
+	}
+	callGraph.nextContext = 0;
+	callGraph.calls = callGraph.interrupts = callGraph.returns = callGraph.switches = callGraph.dropped = 0;
+	return true;
+}
+
+static inline uint32_t callGraphTop() {
+	return callGraph.depth ? callGraph.frames[callGraph.depth - 1].node : 0;
+}
+
+// Forget the frames whose return address is at or below 'sp'
+static void callGraphUnwind(uint16_t sp) {
+	while (callGraph.depth && callGraph.frames[callGraph.depth - 1].sp <= sp) {
+		callGraph.depth--;
+	}
+	callGraph.current = callGraphTop();
+}
+
+static void callGraphEnter(uint32_t entry, uint16_t sp) {
+	callGraphUnwind(sp);
+	if (callGraph.depth == CALLGRAPH_MAX_DEPTH) {
+		callGraph.dropped++;
+		return;
+	}
+	const uint32_t parent = callGraph.current;
+	uint32_t child = callGraph.nodes[parent].firstChild;
+	while (child && callGraph.nodes[child].entry != entry) {
+		child = callGraph.nodes[child].nextSibling;
+	}
+	if (!child) {
+		if (callGraph.nodeCount == CALLGRAPH_MAX_NODES) {
+			callGraph.dropped++;
+			return;
+		}
+		child = callGraph.nodeCount++;
+		callNode_t* node = &callGraph.nodes[child];
+		node->parent = parent;
+		node->firstChild = 0;
+		node->nextSibling = callGraph.nodes[parent].firstChild;
+		node->entry = entry;
+		node->cycles = node->instructions = 0;
+		callGraph.nodes[parent].firstChild = child;
+	}
+	callGraph.frames[callGraph.depth].sp = sp;
+	callGraph.frames[callGraph.depth].node = child;
+	callGraph.depth++;
+	callGraph.current = child;
+}
+
+// SP was loaded, put the frames away under the old SP and take out the ones under the new one
+static void callGraphSwitch(uint16_t from, uint16_t to) {
+	// the same stack, frames above the new SP are still there
+	const uint16_t oldest = callGraph.depth ? callGraph.frames[0].sp : from;
+	if ((uint16_t)(from - to) <= CALLGRAPH_STACK_REACH || (to > from && to <= oldest + CALLGRAPH_STACK_REACH)) {
+		if (to > from) {
+			callGraphUnwind(to - 1);
+		}
+		return;
+	}
+	callContext_t* restored = NULL;
+	callContext_t* saved = NULL;
+	for (int i = 0; i < CALLGRAPH_CONTEXTS; i++) {
+		callContext_t* context = &callGraph.contexts[i];
+		if (context->used && context->sp == to && !restored) {
+			restored = context;
+		} else if (context->used && context->sp == from && !saved) {
+			saved = context;
+		}
+	}
+	if (!saved) {
+		// the oldest one goes, unless it's the one coming back
+		saved = &callGraph.contexts[callGraph.nextContext];
+		callGraph.nextContext = (callGraph.nextContext + 1) % CALLGRAPH_CONTEXTS;
+		if (saved == restored) {
+			saved = &callGraph.contexts[callGraph.nextContext];
+			callGraph.nextContext = (callGraph.nextContext + 1) % CALLGRAPH_CONTEXTS;
+		}
+	}
+	saved->used = true;
+	saved->sp = from;
+	saved->depth = callGraph.depth;
+	memcpy(saved->frames, callGraph.frames, callGraph.depth * sizeof(callFrame_t));
+	callGraph.depth = 0;
+	if (restored) {
+		callGraph.depth = restored->depth;
+		memcpy(callGraph.frames, restored->frames, restored->depth * sizeof(callFrame_t));
+		restored->used = false;
+	}
+	callGraph.switches++;
+	callGraph.current = callGraphTop();
+}
+
+void callGraphInstruction(uint16_t pc, uint8_t bank, uint16_t sp, uint64_t ticks, uint64_t instructions) {
+	callNode_t* node = &callGraph.nodes[callGraph.current];
+	node->cycles += ticks - callGraph.lastTicks;
+	node->instructions += instructions - callGraph.lastInstructions;
+	// after an interrupt, where the instruction before it left PC and SP
+	const uint16_t handlerPc = pc, handlerSp = sp;
+	if (callGraph.interrupted) {
+		pc = readMappedMemory(sp) | (readMappedMemory(sp + 1) << 8);
+		sp += 2;
+	}
+	const uint16_t last = callGraph.lastPc;
+	const uint8_t op = callGraph.lastOp[0], op2 = callGraph.lastOp[1];
+	if (sp == (uint16_t)(callGraph.lastSp - 2)) {
+		const uint16_t pushed = readMappedMemory(sp) | (readMappedMemory(sp + 1) << 8);
+		if (((op == 0xCD || (op & 0xC7) == 0xC4) && pushed == (uint16_t)(last + 3)) ||
+			((op & 0xC7) == 0xC7 && pushed == (uint16_t)(last + 1))) {
+			// CALL, CALL cc and RST
+			callGraph.calls++;
+			callGraphEnter(profileIndex(pc, bank), sp);
+		}
+	} else if (sp == (uint16_t)(callGraph.lastSp + 2) &&
+		(op == 0xC9 || (op & 0xC7) == 0xC0 || (op == 0xED && (op2 & 0xC7) == 0x45))) {
+		// RET, RET cc, RETI and RETN
+		callGraph.returns++;
+		callGraphUnwind(callGraph.lastSp);
+	} else if (sp != callGraph.lastSp &&
+		(op == 0x31 || op == 0xF9 || (op == 0xED && op2 == 0x7B) || ((op == 0xDD || op == 0xFD) && op2 == 0xF9))) {
+		// LD SP,nn, LD SP,HL, LD SP,(nn), LD SP,IX and LD SP,IY
+		callGraphSwitch(callGraph.lastSp, sp);
+	}
+	if (callGraph.interrupted) {
+		callGraph.interrupted = false;
+		callGraph.interrupts++;
+		callGraphEnter(profileIndex(handlerPc, bank) | CALLGRAPH_INTERRUPT, handlerSp);
+	}
+	callGraph.lastPc = handlerPc;
+	callGraph.lastSp = handlerSp;
+	callGraph.lastOp[0] = readMappedMemory(handlerPc);
+	callGraph.lastOp[1] = readMappedMemory(handlerPc + 1);
+	callGraph.lastTicks = ticks;
+	callGraph.lastInstructions = instructions;
+}
+
+static int callGraphName(char* buffer, size_t size, uint32_t entry, profileSymbol_t* symbols, int symbolCount) {
+	const char* kind = (entry & CALLGRAPH_INTERRUPT) ? "int:" : "";
+	const uint32_t index = entry & ~CALLGRAPH_INTERRUPT;
+	const uint16_t address = index < 0x10000 ? (uint16_t)index : (uint16_t)(MEM_BANK_START + (index - 0x10000) % MEM_BANK_SIZE);
+	const profileSymbol_t* symbol = symbols ? profileSymbolAt(symbols, symbolCount, address) : NULL;
+	if (symbol && symbol->address == address) {
+		return snprintf(buffer, size, "%s%s", kind, symbol->name);
+	}
+	if (symbol) {
+		return snprintf(buffer, size, "%s%s+%u", kind, symbol->name, (unsigned)(address - symbol->address));
+	}
+	if (index >= 0x10000) {
+		return snprintf(buffer, size, "%s%02X:%04X", kind, (unsigned)((index - 0x10000) / MEM_BANK_SIZE), address);
+	}
+	return snprintf(buffer, size, "%s%04X", kind, address);
+}
+
+bool callGraphWrite(const char* path, const char* symbolPath) {
+	int symbolCount = 0;
+	profileSymbol_t* symbols = NULL;
+	if (symbolPath) {
+		symbols = profileLoadSymbols(symbolPath, &symbolCount);
+		if (!symbols) {
+			return false;
+		}
+	}
+	FILE* out = fopen(path, "w");
+	if (!out) {
+		free(symbols);
+		return false;
+	}
+	static uint32_t stack[CALLGRAPH_MAX_DEPTH];
+	// the deepest stack fits, no line is ever cut short
+	static char line[sizeof("reset") + CALLGRAPH_MAX_DEPTH * (1 + CALLGRAPH_NAME_MAX)];
+	for (uint32_t i = 0; i < callGraph.nodeCount; i++) {
+		const callNode_t* node = &callGraph.nodes[i];
+		if (!node->cycles) {
+			continue;
+		}
+		// root first
+		int length = 0;
+		for (uint32_t at = i; at != 0 && length < CALLGRAPH_MAX_DEPTH; at = callGraph.nodes[at].parent) {
+			stack[length++] = at;
+		}
+		size_t used = snprintf(line, sizeof(line), "reset");
+		while (length-- > 0) {
+			line[used++] = ';';
+			used += callGraphName(line + used, sizeof(line) - used, callGraph.nodes[stack[length]].entry, symbols, symbolCount);
+		}
+		fprintf(out, "%s %llu\n", line, (unsigned long long)node->cycles);
+	}
+	const bool ok = ferror(out) == 0;
+	fclose(out);
+	free(symbols);
+	return ok;
+}
+
+#endif // CHIPS_IMPL
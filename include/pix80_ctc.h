@@ -0,0 +1,226 @@
+#pragma once
+/*
+ * Pix80 Z80 CTC, counter/timer circuit
+ *
+ * Four channels, one port each from the one it's attached to. A write
+ * is a control word when bit 0 is set:
+ *
+ *   bit 7  interrupt on zero count
+ *   bit 6  counter mode (counts CLK/TRG pulses) rather than timer mode
+ *   bit 5  timer prescaler 256 rather than 16
+ *   bit 4  CLK/TRG edge, there are no edges here, ignored
+ *   bit 3  timer waits for a CLK/TRG pulse to start
+ *   bit 2  the next write is the time constant (1-256, 0 is 256)
+ *   bit 1  software reset, stops the channel until it gets a constant
+ *
+ * A write with bit 0 clear to channel 0 sets the interrupt vector,
+ * bits 1-2 of it are filled in with the channel number. Reading a
+ * channel gives its down counter.
+ *
+ * Timer channels don't count down cycle by cycle, each posts an event
+ * for its next zero count and works out the counter when it's read.
+ * The zero count output of channels 0-2 is wired to CLK/TRG of the
+ * next channel, so they can be cascaded, ctcTrigger() pulses it from
+ * outside. The channels are on the interrupt daisy chain, channel 0
+ * first.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "pix80_io.h"
+#include "pix80_sched.h"
+#include "pix80_daisy.h"
+
+#define CTC_CHANNELS 4
+
+#define CTC_INTERRUPT  0x80
+#define CTC_COUNTER    0x40
+#define CTC_PRESCALE   0x20
+#define CTC_TRIGGER    0x08
+#define CTC_CONSTANT   0x04
+#define CTC_RESET      0x02
+#define CTC_CONTROL    0x01
+
+typedef struct {
+	uint8_t control;
+	// 0 counts as 256
+	uint8_t constant;
+	bool constantNext;
+	bool running;
+	// timer mode started, waiting for CLK/TRG
+	bool waiting;
+	// counter mode down counter
+	uint16_t count;
+	// timer mode, cycle of the next zero count and cycles between them
+	uint64_t zeroAt;
+	uint32_t period;
+	schedEvent_t zero;
+	daisySource_t irq;
+	uint64_t zeroCounts;
+} ctcChannel_t;
+
+typedef struct {
+	uint8_t port;
+	uint8_t vector;
+	ctcChannel_t channels[CTC_CHANNELS];
+} ctc_t;
+
+extern ctc_t ctc;
+
+void ctcInit();
+// attach the channels to CTC_CHANNELS ports from 'port' on, and to the daisy chain
+void attachCTC(uint8_t port);
+// a pulse on the channel's CLK/TRG input at 'cycle'
+void ctcTrigger(int channel, uint64_t cycle);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+
+ctc_t ctc;
+
+static inline uint16_t ctcConstant(const ctcChannel_t* channel) {
+	return channel->constant ? channel->constant : 256;
+}
+
+static void ctcStartTimer(ctcChannel_t* channel, uint64_t cycle) {
+	const uint32_t prescale = (channel->control & CTC_PRESCALE) ? 256 : 16;
+	channel->period = prescale * ctcConstant(channel);
+	channel->zeroAt = cycle + channel->period;
+	channel->waiting = false;
+	schedAt(&channel->zero, channel->zeroAt);
+}
+
+static void ctcZeroCount(int index, uint64_t cycle) {
+	ctcChannel_t* channel = &ctc.channels[index];
+	channel->zeroCounts++;
+	if (channel->control & CTC_INTERRUPT) {
+		daisyRequest(&channel->irq, cycle);
+	}
+	if (index < CTC_CHANNELS - 1) {
+		// ZC/TO drives the next channel's CLK/TRG
+		ctcTrigger(index + 1, cycle);
+	}
+}
+
+static void ctcTimerZero(void* context, uint64_t cycle) {
+	ctcChannel_t* channel = (ctcChannel_t*)context;
+	// reloads from the constant, a new one takes effect now
+	ctcStartTimer(channel, cycle);
+	ctcZeroCount((int)(channel - ctc.channels), cycle);
+}
+
+void ctcTrigger(int index, uint64_t cycle) {
+	ctcChannel_t* channel = &ctc.channels[index];
+	if (!channel->running) {
+		return;
+	}
+	if (channel->control & CTC_COUNTER) {
+		if (--channel->count == 0) {
+			channel->count = ctcConstant(channel);
+			ctcZeroCount(index, cycle);
+		}
+	} else if (channel->waiting) {
+		ctcStartTimer(channel, cycle);
+	}
+}
+
+static void ctcStop(ctcChannel_t* channel) {
+	channel->running = channel->waiting = false;
+	schedCancel(&channel->zero);
+}
+
+static void ctcLoadConstant(ctcChannel_t* channel, uint8_t data) {
+	channel->constant = data;
+	channel->constantNext = false;
+	if (channel->running) {
+		// takes effect with the next zero count
+		return;
+	}
+	channel->running = true;
+	channel->count = ctcConstant(channel);
+	if (!(channel->control & CTC_COUNTER)) {
+		if (channel->control & CTC_TRIGGER) {
+			channel->waiting = true;
+		} else {
+			ctcStartTimer(channel, totalTicks);
+		}
+	}
+}
+
+static void ctcControl(ctcChannel_t* channel, uint8_t data) {
+	const uint8_t changed = channel->control ^ data;
+	channel->control = data;
+	if (!(data & CTC_INTERRUPT)) {
+		daisyWithdraw(&channel->irq);
+	}
+	if (data & CTC_RESET) {
+		ctcStop(channel);
+	} else if (channel->running && (changed & (CTC_COUNTER | CTC_PRESCALE))) {
+		// switched modes on the fly, start over from the constant
+		channel->running = false;
+		schedCancel(&channel->zero);
+		ctcLoadConstant(channel, channel->constant);
+	}
+	channel->constantNext = (data & CTC_CONSTANT) != 0;
+}
+
+static uint8_t ctcRead(void* context, uint16_t port) {
+	(void)context;
+	const ctcChannel_t* channel = &ctc.channels[(uint8_t)(port - ctc.port)];
+	if (!channel->running) {
+		return (uint8_t)channel->count;
+	}
+	if ((channel->control & CTC_COUNTER) || channel->waiting) {
+		return (uint8_t)channel->count;
+	}
+	// timer mode, count what's left until the next zero
+	const uint32_t prescale = (channel->control & CTC_PRESCALE) ? 256 : 16;
+	const uint64_t left = channel->zeroAt > totalTicks ? channel->zeroAt - totalTicks : 0;
+	return (uint8_t)((left + prescale - 1) / prescale);
+}
+
+static void ctcWrite(void* context, uint16_t port, uint8_t data) {
+	(void)context;
+	const int index = (uint8_t)(port - ctc.port);
+	ctcChannel_t* channel = &ctc.channels[index];
+	if (channel->constantNext) {
+		ctcLoadConstant(channel, data);
+	} else if (data & CTC_CONTROL) {
+		ctcControl(channel, data);
+	} else if (index == 0) {
+		ctc.vector = data & 0xF8;
+		for (int i = 0; i < CTC_CHANNELS; i++) {
+			ctc.channels[i].irq.vector = ctc.vector | (i << 1);
+		}
+	}
+}
+
+void ctcInit() {
+	static const char* names[CTC_CHANNELS] = { "ctc0", "ctc1", "ctc2", "ctc3" };
+	ctc.vector = 0;
+	for (int i = 0; i < CTC_CHANNELS; i++) {
+		ctcChannel_t* channel = &ctc.channels[i];
+		channel->control = CTC_RESET | CTC_CONTROL;
+		channel->constant = 0;
+		channel->constantNext = channel->running = channel->waiting = false;
+		channel->count = 0;
+		channel->zeroAt = 0;
+		channel->period = 0;
+		channel->zeroCounts = 0;
+		schedInit(&channel->zero, names[i], ctcTimerZero, channel);
+		daisyInit(&channel->irq, names[i]);
+		channel->irq.vector = i << 1;
+	}
+}
+
+void attachCTC(uint8_t port) {
+	ctc.port = port;
+	ioRegisterRange(port, CTC_CHANNELS, "ctc", ctcRead, ctcWrite, &ctc);
+	for (int i = 0; i < CTC_CHANNELS; i++) {
+		daisyAttach(&ctc.channels[i].irq);
+	}
+}
+
+#endif // CHIPS_IMPL
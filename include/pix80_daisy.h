@@ -0,0 +1,148 @@
+#pragma once
+/*
+ * Pix80 interrupt daisy chain
+ *
+ * The Z80 family chips (CTC, PIO, SIO) share the INT line and settle
+ * who gets to interrupt through a priority chain. Every interrupt
+ * source in them has an IEI input, fed by the IEO output of the one
+ * before it, and pulls IEO low while it's being serviced:
+ *
+ *  - a source can only request an interrupt while its IEI is high,
+ *    i.e. nothing before it is being serviced, itself included
+ *  - the IORQ|M1 acknowledge goes to the first requesting source,
+ *    which puts its IM 2 vector on the bus and is then serviced
+ *  - a RETI (z80.h's Z80_RETI pin) ends the service of the first
+ *    source that's being serviced
+ *
+ * z80.h's own chips are ticked every cycle and hand Z80_IEIO down
+ * the chain. Here the chain is a list in priority order that's only
+ * looked at when something on it can change: a device event, an I/O
+ * access, an acknowledge or a RETI. Idle chips cost nothing.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "pix80_io.h"
+
+#define DAISY_MAX_SOURCES 32
+
+typedef struct {
+	const char* name;
+	// what goes on the data bus when this one is acknowledged
+	uint8_t vector;
+	bool request;
+	bool servicing;
+	uint64_t requests;
+	uint64_t acknowledged;
+	// cycles from request to acknowledge
+	uint64_t requestedAt;
+	uint64_t latencyTotal;
+	uint64_t latencyMax;
+} daisySource_t;
+
+typedef struct {
+	daisySource_t* sources[DAISY_MAX_SOURCES];
+	int count;
+	// sources with a request up, so a quiet chain is one compare
+	int requesting;
+} daisyChain_t;
+
+extern daisyChain_t daisyChain;
+
+void daisyInit(daisySource_t* source, const char* name);
+// add a source to the end of the chain, every one after has lower priority
+void daisyAttach(daisySource_t* source);
+// the source wants to interrupt, 'cycle' is when its condition came up
+void daisyRequest(daisySource_t* source, uint64_t cycle);
+// the source no longer wants to interrupt (cleared by the CPU or disabled)
+void daisyWithdraw(daisySource_t* source);
+// the source that gets the next acknowledge, NULL if none may interrupt
+daisySource_t* daisyRequester();
+// IORQ|M1 cycle at 'cycle', returns the vector of the source that gets it
+uint8_t daisyAcknowledge(uint64_t cycle);
+// RETI, ends the service of the highest priority source in service
+void daisyReti();
+
+static inline bool daisyIntPending() {
+	return daisyChain.requesting && daisyRequester() != NULL;
+}
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+
+daisyChain_t daisyChain;
+
+void daisyInit(daisySource_t* source, const char* name) {
+	source->name = name;
+	source->vector = 0;
+	source->request = source->servicing = false;
+	source->requests = source->acknowledged = 0;
+	source->requestedAt = source->latencyTotal = source->latencyMax = 0;
+}
+
+void daisyAttach(daisySource_t* source) {
+	if (daisyChain.count < DAISY_MAX_SOURCES) {
+		daisyChain.sources[daisyChain.count++] = source;
+	}
+}
+
+void daisyRequest(daisySource_t* source, uint64_t cycle) {
+	if (!source->request) {
+		source->request = true;
+		daisyChain.requesting++;
+		ioInterruptRaised = true;
+		source->requestedAt = cycle;
+		source->requests++;
+	}
+}
+
+void daisyWithdraw(daisySource_t* source) {
+	if (source->request) {
+		source->request = false;
+		daisyChain.requesting--;
+	}
+}
+
+daisySource_t* daisyRequester() {
+	for (int i = 0; i < daisyChain.count; i++) {
+		daisySource_t* source = daisyChain.sources[i];
+		if (source->servicing) {
+			// IEO low, nothing from here on may interrupt
+			return NULL;
+		}
+		if (source->request) {
+			return source;
+		}
+	}
+	return NULL;
+}
+
+uint8_t daisyAcknowledge(uint64_t cycle) {
+	daisySource_t* source = daisyRequester();
+	if (!source) {
+		// nobody drives the data bus
+		return 0xFF;
+	}
+	daisyWithdraw(source);
+	source->servicing = true;
+	source->acknowledged++;
+	const uint64_t latency = cycle > source->requestedAt ? cycle - source->requestedAt : 0;
+	source->latencyTotal += latency;
+	if (latency > source->latencyMax) {
+		source->latencyMax = latency;
+	}
+	return source->vector;
+}
+
+void daisyReti() {
+	for (int i = 0; i < daisyChain.count; i++) {
+		if (daisyChain.sources[i]->servicing) {
+			daisyChain.sources[i]->servicing = false;
+			return;
+		}
+	}
+}
+
+#endif // CHIPS_IMPL
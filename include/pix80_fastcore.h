@@ -0,0 +1,673 @@
+#pragma once
+/*
+ * Pix80 fast Z80 core
+ *
+ * An instruction-atomic interpreter for when bus accuracy doesn't
+ * matter. It decodes and executes a whole instruction at a time on
+ * the same z80_t and page table as z80_tick(), unprefixed ones with
+ * z80OpExecute() from pix80_ops.h, the CB, ED, DD and FD prefixed ones
+ * with z80.h's own flag helpers. Registers, flags, WZ, R and T-states
+ * end up exactly as the cycle-stepped core leaves them, so the two can
+ * hand over to each other at any instruction boundary.
+ *
+ * What it leaves to z80_tick(): taking interrupts and everything that
+ * changes how the next one is taken (HALT, DI, EI, RETI, RETN).
+ * fastRun() stops in front of those and lets the caller run them on
+ * the cycle-stepped core, then carries on. I/O goes straight to the
+ * port's device through pix80_io.h, with totalTicks moved up to the
+ * tick the cycle-stepped core would do it on, and a run ends after one
+ * that raised an interrupt or posted an event that's due before the
+ * run would end.
+ *
+ * LDIR, LDDR, CPIR and CPDR copy or search with memmove()/memchr() a
+ * page at a time and only run their last iteration the slow way, the
+ * other repeating block instructions still skip the bus. The cycle-
+ * stepped core uses that too, through fastBlockRun().
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "z80.h"
+#include "pix80_io.h"
+#include "pix80_memory.h"
+#include "pix80_ops.h"
+#include "pix80_sched.h"
+
+typedef struct {
+	uint64_t instructions;
+	uint64_t runs;
+	// repeating block instructions run by fastBlockRun()
+	uint64_t blockIterations;
+	uint64_t blockRuns;
+} fastStats_t;
+
+extern fastStats_t fastStats;
+// fastRun() stops in front of the instruction at this address, -1 for none
+extern int32_t fastBreakpoint;
+
+// The longest instruction the fast core runs, a run of prefixes in
+// front of one is left to the cycle-stepped core
+#define FAST_MAX_CYCLES 23
+
+// Run instructions from 'pc' for at most 'budget' cycles, as long as
+// the next one is sure to fit in what's left and doesn't need the
+// cycle-stepped core. False if not even the first one could run.
+// Afterwards PC is the next instruction, which hasn't been fetched yet.
+bool fastRun(z80_t* cpu, uint16_t pc, uint64_t budget, z80BlockResult_t* result);
+// Run the LDIR, LDDR, CPIR, CPDR, INIR, INDR, OTIR or OTDR at 'pc' until
+// it ends or the next iteration doesn't fit in 'budget' cycles, every
+// iteration counts as an instruction. False if there's no such
+// instruction at 'pc' or not even one iteration fits.
+bool fastBlockRun(z80_t* cpu, uint16_t pc, uint64_t budget, z80BlockResult_t* result);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <string.h>
+
+fastStats_t fastStats;
+int32_t fastBreakpoint = -1;
+
+// one refresh cycle per opcode fetch, prefixes included
+static inline void fastRefresh(z80_t* cpu, uint8_t fetches) {
+	cpu->r = (cpu->r & 0x80) | ((cpu->r + fetches) & 0x7F);
+}
+
+// B, C, D, E, H, L, -, A as encoded in bits 0-2 or 3-5 of an opcode
+static inline uint8_t fastGetRegister(const z80_t* cpu, uint8_t index) {
+	switch (index) {
+		case 0: return cpu->b;
+		case 1: return cpu->c;
+		case 2: return cpu->d;
+		case 3: return cpu->e;
+		case 4: return cpu->h;
+		case 5: return cpu->l;
+		case 7: return cpu->a;
+		default: return 0;
+	}
+}
+
+static inline void fastSetRegister(z80_t* cpu, uint8_t index, uint8_t value) {
+	switch (index) {
+		case 0: cpu->b = value; break;
+		case 1: cpu->c = value; break;
+		case 2: cpu->d = value; break;
+		case 3: cpu->e = value; break;
+		case 4: cpu->h = value; break;
+		case 5: cpu->l = value; break;
+		case 7: cpu->a = value; break;
+		default: break;
+	}
+}
+
+// BC, DE, HL, SP as encoded in bits 4-5 of an opcode
+static inline uint16_t* fastRegisterPair(z80_t* cpu, uint8_t opcode) {
+	switch ((opcode >> 4) & 3) {
+		case 0: return &cpu->bc;
+		case 1: return &cpu->de;
+		case 2: return &cpu->hl;
+		default: return &cpu->sp;
+	}
+}
+
+// ADD, ADC, SUB, SBC, AND, XOR, OR, CP as encoded in bits 3-5
+static inline void fastALU(z80_t* cpu, uint8_t opcode, uint8_t value) {
+	switch ((opcode >> 3) & 7) {
+		case 0: _z80_add8(cpu, value); break;
+		case 1: _z80_adc8(cpu, value); break;
+		case 2: _z80_sub8(cpu, value); break;
+		case 3: _z80_sbc8(cpu, value); break;
+		case 4: _z80_and8(cpu, value); break;
+		case 5: _z80_xor8(cpu, value); break;
+		case 6: _z80_or8(cpu, value); break;
+		default: _z80_cp8(cpu, value); break;
+	}
+}
+
+// Unprefixed instruction at 'pc' whose H and L may stand for IXH/IXL or
+// IYH/IYL, returns 0 if it has to run on the cycle-stepped core
+static inline __attribute__((always_inline)) uint32_t fastUnprefixed(z80_t* cpu, uint16_t pc, uint8_t opcode) {
+	const uint32_t length = z80OpInfo[opcode] & Z80_OP_LENGTH;
+	uint16_t operand = 0;
+	if (length > 1) {
+		operand = readMappedMemory(pc + 1);
+		if (length > 2) {
+			operand |= readMappedMemory(pc + 2) << 8;
+		}
+	}
+	if (z80OpInfo[opcode] & Z80_OP_ATOMIC) {
+		cpu->pc = pc + length;
+		return z80OpExecute(cpu, opcode, operand);
+	}
+	switch (opcode) {
+		case 0xD3: // OUT (n),A
+			cpu->pc = pc + 2;
+			cpu->wzl = (uint8_t)operand;
+			cpu->wzh = cpu->a;
+			// the device sees the tick z80_tick() gets to the I/O cycle on
+			totalTicks += 7;
+			ioWrite(cpu->wz, cpu->a);
+			cpu->wzl++;
+			return 11;
+		case 0xDB: // IN A,(n)
+			cpu->pc = pc + 2;
+			cpu->wzl = (uint8_t)operand;
+			cpu->wzh = cpu->a;
+			totalTicks += 8;
+			cpu->a = ioRead(cpu->wz++);
+			return 11;
+		default:
+			// HALT, DI and EI
+			return 0;
+	}
+}
+
+// CB prefixed rotates, shifts and bit operations, PC points at the CB
+static inline uint32_t fastCB(z80_t* cpu, uint16_t pc) {
+	cpu->opcode = readMappedMemory(pc + 1);
+	cpu->pc = pc + 2;
+	const uint8_t z = cpu->opcode & 7;
+	if (z != 6) {
+		_z80_cb_action(cpu, z, z);
+		return 8;
+	}
+	cpu->dlatch = readMappedMemory(cpu->hl);
+	if (!_z80_cb_action(cpu, 6, 6)) {
+		// BIT n,(HL)
+		return 12;
+	}
+	writeMappedMemory(cpu->hl, cpu->dlatch);
+	return 15;
+}
+
+// DD CB d op and FD CB d op, PC points at the CB
+static inline uint32_t fastIndexedCB(z80_t* cpu, uint16_t pc, uint16_t index) {
+	cpu->addr = index + (int8_t)readMappedMemory(pc + 1);
+	cpu->wz = cpu->addr;
+	cpu->opcode = readMappedMemory(pc + 2);
+	cpu->pc = pc + 3;
+	cpu->dlatch = readMappedMemory(cpu->addr);
+	// the result also goes to the register in bits 0-2, unless that's (HL)
+	if (!_z80_cb_action(cpu, 6, cpu->opcode & 7)) {
+		return 16;
+	}
+	writeMappedMemory(cpu->addr, cpu->dlatch);
+	return 19;
+}
+
+// One iteration of a block instruction, PC points at the ED. Bit 3 of
+// the opcode counts down, bit 4 repeats by going back to the ED.
+static inline uint32_t fastBlock(z80_t* cpu, uint16_t pc, uint8_t opcode) {
+	uint8_t value;
+	cpu->pc = pc + 2;
+	const bool down = opcode & 0x08;
+	const bool repeat = opcode & 0x10;
+	bool again;
+	switch (opcode & 3) {
+		case 0: // LDI, LDD, LDIR, LDDR
+			value = readMappedMemory(cpu->hl);
+			writeMappedMemory(cpu->de, value);
+			cpu->hl += down ? -1 : 1;
+			cpu->de += down ? -1 : 1;
+			again = _z80_ldi_ldd(cpu, value);
+			break;
+		case 1: // CPI, CPD, CPIR, CPDR
+			value = readMappedMemory(cpu->hl);
+			cpu->hl += down ? -1 : 1;
+			cpu->wz += down ? -1 : 1;
+			again = _z80_cpi_cpd(cpu, value);
+			break;
+		case 2: // INI, IND, INIR, INDR
+			// T-states into the iteration, as with OUT (n),A
+			totalTicks += 10;
+			value = ioRead(cpu->bc);
+			cpu->wz = cpu->bc + (down ? -1 : 1);
+			cpu->b--;
+			writeMappedMemory(cpu->hl, value);
+			cpu->hl += down ? -1 : 1;
+			again = _z80_ini_ind(cpu, value, cpu->c + (down ? -1 : 1));
+			break;
+		default: // OUTI, OUTD, OTIR, OTDR
+			value = readMappedMemory(cpu->hl);
+			cpu->hl += down ? -1 : 1;
+			cpu->b--;
+			totalTicks += 12;
+			ioWrite(cpu->bc, value);
+			cpu->wz = cpu->bc + (down ? -1 : 1);
+			again = _z80_outi_outd(cpu, value);
+			break;
+	}
+	if (repeat && again) {
+		cpu->pc = pc;
+		cpu->wz = pc + 1;
+		return 21;
+	}
+	return 16;
+}
+
+// ED prefixed instructions, PC points at the ED. Returns 0 for RETI and
+// RETN, ED opcodes that don't do anything act as an 8 cycle NOP.
+static inline uint32_t fastED(z80_t* cpu, uint16_t pc) {
+	const uint8_t opcode = readMappedMemory(pc + 1);
+	const uint8_t y = (opcode >> 3) & 7;
+	uint8_t value;
+	if ((opcode & 0xC7) == 0x45) {
+		return 0;
+	}
+	cpu->pc = pc + 2;
+	if (opcode >= 0x40 && opcode < 0x80) {
+		switch (opcode & 0x0F) {
+			case 0x00: case 0x08: // IN r,(C), IN (C)
+				// T-states into the instruction, as with OUT (n),A
+				totalTicks += 9;
+				value = _z80_in(cpu, ioRead(cpu->bc));
+				cpu->wz = cpu->bc + 1;
+				fastSetRegister(cpu, y, value);
+				return 12;
+			case 0x01: case 0x09: // OUT (C),r, OUT (C),0
+				totalTicks += 8;
+				ioWrite(cpu->bc, y == 6 ? 0 : fastGetRegister(cpu, y));
+				cpu->wz = cpu->bc + 1;
+				return 12;
+			case 0x02: _z80_sbc16(cpu, *fastRegisterPair(cpu, opcode)); return 15; // SBC HL,rr
+			case 0x0A: _z80_adc16(cpu, *fastRegisterPair(cpu, opcode)); return 15; // ADC HL,rr
+			case 0x03: { // LD (nn),rr
+				const uint16_t pair = *fastRegisterPair(cpu, opcode);
+				cpu->wz = readMappedMemory(pc + 2) | (readMappedMemory(pc + 3) << 8);
+				cpu->pc = pc + 4;
+				writeMappedMemory(cpu->wz++, (uint8_t)pair);
+				writeMappedMemory(cpu->wz, pair >> 8);
+				return 20;
+			}
+			case 0x0B: { // LD rr,(nn)
+				uint16_t* pair = fastRegisterPair(cpu, opcode);
+				cpu->wz = readMappedMemory(pc + 2) | (readMappedMemory(pc + 3) << 8);
+				cpu->pc = pc + 4;
+				value = readMappedMemory(cpu->wz++);
+				*pair = value | (readMappedMemory(cpu->wz) << 8);
+				return 20;
+			}
+			case 0x04: case 0x0C: _z80_neg8(cpu); return 8; // NEG
+			case 0x06: case 0x0E: { // IM 0/1/2
+				static const uint8_t modes[4] = { 0, 0, 1, 2 };
+				cpu->im = modes[y & 3];
+				return 8;
+			}
+			default:
+				break;
+		}
+		switch (opcode) {
+			case 0x47: cpu->i = cpu->a; return 9; // LD I,A
+			case 0x4F: cpu->r = cpu->a; return 9; // LD R,A
+			case 0x57: cpu->a = cpu->i; cpu->f = _z80_sziff2_flags(cpu, cpu->i); return 9; // LD A,I
+			case 0x5F: cpu->a = cpu->r; cpu->f = _z80_sziff2_flags(cpu, cpu->r); return 9; // LD A,R
+			case 0x67: // RRD
+				value = _z80_rrd(cpu, readMappedMemory(cpu->hl));
+				writeMappedMemory(cpu->hl, value);
+				cpu->wz = cpu->hl + 1;
+				return 18;
+			case 0x6F: // RLD
+				value = _z80_rld(cpu, readMappedMemory(cpu->hl));
+				writeMappedMemory(cpu->hl, value);
+				cpu->wz = cpu->hl + 1;
+				return 18;
+			default:
+				return 8;
+		}
+	}
+	if (opcode < 0xA0 || (opcode & 0x04) || opcode >= 0xC0) {
+		return 8;
+	}
+	return fastBlock(cpu, pc, opcode);
+}
+
+// DD or FD prefixed instruction with the prefix's index register,
+// PC points past the prefix
+static inline uint32_t fastIndexed(z80_t* cpu, uint16_t pc, uint8_t opcode, uint16_t* index) {
+	const bool memory = (opcode == 0x34 || opcode == 0x35 || opcode == 0x36) ||
+		((opcode & 0xC0) == 0x40 && ((opcode & 7) == 6 || (opcode & 0x38) == 0x30) && opcode != 0x76) ||
+		((opcode & 0xC7) == 0x86);
+	if (!memory) {
+		if (opcode == 0xEB || opcode == 0xD9) {
+			// EX DE,HL and EXX always use HL
+			return fastUnprefixed(cpu, pc, opcode);
+		}
+		// everything else that uses HL, H or L uses the index register instead
+		const uint16_t hl = cpu->hl;
+		cpu->hl = *index;
+		const uint32_t cycles = fastUnprefixed(cpu, pc, opcode);
+		*index = cpu->hl;
+		cpu->hl = hl;
+		return cycles;
+	}
+	// (IX+d) and (IY+d), the registers are the real H and L
+	const uint16_t address = *index + (int8_t)readMappedMemory(pc + 1);
+	cpu->wz = address;
+	cpu->pc = pc + 2;
+	uint8_t value;
+	switch (opcode) {
+		case 0x34: // INC (IX+d)
+			value = _z80_inc8(cpu, readMappedMemory(address));
+			writeMappedMemory(address, value);
+			return 19;
+		case 0x35: // DEC (IX+d)
+			value = _z80_dec8(cpu, readMappedMemory(address));
+			writeMappedMemory(address, value);
+			return 19;
+		case 0x36: // LD (IX+d),n
+			cpu->pc = pc + 3;
+			writeMappedMemory(address, readMappedMemory(pc + 2));
+			return 15;
+		default:
+			break;
+	}
+	if ((opcode & 0xF8) == 0x70) {
+		// LD (IX+d),r
+		writeMappedMemory(address, fastGetRegister(cpu, opcode & 7));
+	} else if ((opcode & 0xC0) == 0x40) {
+		// LD r,(IX+d)
+		fastSetRegister(cpu, (opcode >> 3) & 7, readMappedMemory(address));
+	} else {
+		fastALU(cpu, opcode, readMappedMemory(address));
+	}
+	return 15;
+}
+
+// Everything but the plain unprefixed instructions, returns 0 without
+// changing anything if the instruction has to run on the cycle-stepped core
+static __attribute__((noinline)) uint32_t fastPrefixed(z80_t* cpu, uint16_t pc, uint8_t opcode) {
+	uint32_t cycles = 0;
+	uint8_t fetches = 1;
+	uint16_t* index = NULL;
+	if (opcode == 0xDD || opcode == 0xFD) {
+		index = opcode == 0xDD ? &cpu->ix : &cpu->iy;
+		opcode = readMappedMemory(++pc);
+		cycles += 4;
+		fetches++;
+		// an I/O instruction behind it does its I/O that much later
+		totalTicks += 4;
+	}
+	// a prefix that does nothing, in front of another one or of ED,
+	// could make the instruction take longer than FAST_MAX_CYCLES
+	if (opcode == 0xDD || opcode == 0xFD || (index && opcode == 0xED)) {
+		return 0;
+	}
+	if (opcode == 0xED) {
+		if ((readMappedMemory(pc + 1) & 0xC7) == 0x45) {
+			return 0;
+		}
+		fastRefresh(cpu, fetches + 1);
+		return cycles + fastED(cpu, pc);
+	}
+	if (opcode == 0x76 || opcode == 0xF3 || opcode == 0xFB) {
+		return 0;
+	}
+	fastRefresh(cpu, fetches);
+	if (opcode == 0xCB) {
+		if (index) {
+			// the opcode after d is read like data, not fetched
+			return cycles + fastIndexedCB(cpu, pc, *index);
+		}
+		fastRefresh(cpu, 1);
+		return fastCB(cpu, pc);
+	}
+	if (index) {
+		return cycles + fastIndexed(cpu, pc, opcode, index);
+	}
+	return fastUnprefixed(cpu, pc, opcode);
+}
+
+// LDIR's copy of 'count' bytes between two host pages, a byte at a time
+// from the bottom up. When the destination starts inside the source,
+// what's been copied is copied again, so the first bytes repeat.
+static void fastCopyUp(uint8_t* to, const uint8_t* from, uint32_t count) {
+	if (to <= from || to >= from + count) {
+		memmove(to, from, count);
+		return;
+	}
+	const uint32_t period = (uint32_t)(to - from);
+	if (period == 1) {
+		// the usual LD (HL),n / LDIR fill
+		memset(to, *from, count);
+		return;
+	}
+	for (uint32_t done = 0; done < count; done += period) {
+		memcpy(to + done, from + done, count - done < period ? count - done : period);
+	}
+}
+
+// The same for LDDR, 'to' and 'from' point at the lowest of the bytes
+static void fastCopyDown(uint8_t* to, const uint8_t* from, uint32_t count) {
+	if (from <= to || from >= to + count) {
+		memmove(to, from, count);
+		return;
+	}
+	const uint32_t period = (uint32_t)(from - to);
+	if (period == 1) {
+		memset(to, from[count - 1], count);
+		return;
+	}
+	for (uint32_t left = count; left > 0;) {
+		const uint32_t length = left < period ? left : period;
+		left -= length;
+		memcpy(to + left, from + left, length);
+	}
+}
+
+// Bytes from 'address' to the end of its page in the direction of travel
+static inline uint32_t fastPageRoom(uint16_t address, bool down) {
+	return down ? (address & MEM_PAGE_MASK) + 1 : MEM_PAGE_SIZE - (address & MEM_PAGE_MASK);
+}
+
+// 'count' iterations of LDIR or LDDR that all repeat, a page at a time
+static void fastBulkCopy(z80_t* cpu, bool down, uint32_t count) {
+	while (count) {
+		uint32_t chunk = count;
+		if (fastPageRoom(cpu->hl, down) < chunk) {
+			chunk = fastPageRoom(cpu->hl, down);
+		}
+		if (fastPageRoom(cpu->de, down) < chunk) {
+			chunk = fastPageRoom(cpu->de, down);
+		}
+		const memPage_t* from = &memPages[cpu->hl >> MEM_PAGE_SHIFT];
+		const memPage_t* to = &memPages[cpu->de >> MEM_PAGE_SHIFT];
+		if (from->read && to->write) {
+			const uint16_t first = down ? chunk - 1 : 0;
+			uint8_t* target = to->write + ((cpu->de - first) & MEM_PAGE_MASK);
+			const uint8_t* source = from->read + ((cpu->hl - first) & MEM_PAGE_MASK);
+			if (down) {
+				fastCopyDown(target, source, chunk);
+			} else {
+				fastCopyUp(target, source, chunk);
+			}
+		} else {
+			// pages that read as 0, discard writes or are watched
+			for (uint32_t i = 0; i < chunk; i++) {
+				const uint16_t offset = down ? -i : i;
+				writeMappedMemory(cpu->de + offset, readMappedMemory(cpu->hl + offset));
+			}
+		}
+		cpu->hl += down ? -chunk : chunk;
+		cpu->de += down ? -chunk : chunk;
+		cpu->bc -= chunk;
+		count -= chunk;
+	}
+}
+
+// Up to 'count' iterations of CPIR or CPDR that all repeat, stops in
+// front of the byte that matches A. Returns how many it ran.
+static uint32_t fastBulkCompare(z80_t* cpu, bool down, uint32_t count) {
+	uint32_t done = 0;
+	while (done < count) {
+		uint32_t chunk = count - done;
+		if (fastPageRoom(cpu->hl, down) < chunk) {
+			chunk = fastPageRoom(cpu->hl, down);
+		}
+		const uint8_t* page = memPages[cpu->hl >> MEM_PAGE_SHIFT].read;
+		uint32_t before = chunk;
+		if (!page) {
+			before = cpu->a == 0 ? 0 : chunk;
+		} else if (down) {
+			const uint8_t* last = page + (cpu->hl & MEM_PAGE_MASK);
+			const uint8_t* match = (const uint8_t*)memrchr(last - (chunk - 1), cpu->a, chunk);
+			before = match ? (uint32_t)(last - match) : chunk;
+		} else {
+			const uint8_t* first = page + (cpu->hl & MEM_PAGE_MASK);
+			const uint8_t* match = (const uint8_t*)memchr(first, cpu->a, chunk);
+			before = match ? (uint32_t)(match - first) : chunk;
+		}
+		cpu->hl += down ? -before : before;
+		cpu->bc -= before;
+		done += before;
+		if (before < chunk) {
+			break;
+		}
+	}
+	return done;
+}
+
+bool fastBlockRun(z80_t* cpu, uint16_t pc, uint64_t budget, z80BlockResult_t* result) {
+	if (readMappedMemory(pc) != 0xED || budget < 21) {
+		return false;
+	}
+	const uint8_t opcode = readMappedMemory(pc + 1);
+	// 0xB0-0xB3 and 0xB8-0xBB
+	if ((opcode & 0xF4) != 0xB0) {
+		return false;
+	}
+	const bool down = opcode & 0x08;
+	const uint64_t start = totalTicks;
+	ioInterruptRaised = false;
+	// every iteration but the last one is a repeating one of 21 cycles
+	const uint64_t fits = budget / 21;
+	const uint32_t count = cpu->bc ? cpu->bc : 0x10000;
+	uint32_t bulk = 0;
+	if ((opcode & 3) < 2) {
+		// all but the last iteration in bulk, it sets the flags and
+		// decides whether to repeat the same way a single one does
+		uint32_t most = (uint32_t)(count < fits ? count : fits) - 1;
+		if ((opcode & 3) == 0) {
+			// every iteration fetches the instruction again, a copy over
+			// it has to stop short and go on one iteration at a time
+			const uint16_t toED = down ? cpu->de - pc : pc - cpu->de;
+			const uint16_t toOpcode = down ? cpu->de - (uint16_t)(pc + 1) : (uint16_t)(pc + 1) - cpu->de;
+			most = toED < most ? toED : most;
+			most = toOpcode < most ? toOpcode : most;
+			fastBulkCopy(cpu, down, most);
+			bulk = most;
+		} else {
+			bulk = fastBulkCompare(cpu, down, most);
+		}
+		if (bulk) {
+			cpu->wz = pc + 1;
+		}
+	}
+	uint64_t cycles = bulk * 21ULL;
+	uint64_t iterations = bulk;
+	// two opcode fetches per iteration
+	fastRefresh(cpu, (uint8_t)(bulk * 2));
+	// the rest, and I/O, one iteration at a time
+	do {
+		// devices see the iteration that accesses them
+		totalTicks = start + cycles;
+		fastRefresh(cpu, 2);
+		cycles += fastBlock(cpu, pc, opcode);
+		iterations++;
+	} while (cpu->pc == pc && cycles + 21 <= budget && !ioInterruptRaised && schedNext() >= start + budget &&
+		readMappedMemory(pc) == 0xED && readMappedMemory(pc + 1) == opcode);
+	totalTicks = start;
+	result->cycles = cycles;
+	result->instructions = iterations;
+	fastStats.blockIterations += iterations;
+	fastStats.blockRuns++;
+	return true;
+}
+
+// Threaded dispatch: every opcode's handler fetches the next opcode and
+// jumps to its handler itself, rather than all of them going back
+// through one shared switch. The host predicts each of those jumps on
+// its own, which is most of the speed of this core.
+#define _FAST_NEXT() \
+	if (cycles + FAST_MAX_CYCLES > budget || cpu->pc == fastBreakpoint) { \
+		goto done; \
+	} \
+	at = cpu->pc; \
+	opcode = readMappedMemory(at); \
+	goto *handlers[opcode];
+// IN and OUT, or a prefix that may stand in front of them
+#define _FAST_IO(op) ((op) == 0xD3 || (op) == 0xDB || (op) == 0xED || (op) == 0xDD || (op) == 0xFD)
+#define _FAST_OP(op) fast_##op: \
+	if (_FAST_IO(op)) { \
+		totalTicks = start + cycles; \
+	} \
+	if (z80OpInfo[op] & Z80_OP_ATOMIC) { \
+		fastRefresh(cpu, 1); \
+		cycles += fastUnprefixed(cpu, at, op); \
+	} else if (op == 0xED && fastBlockRun(cpu, at, budget - cycles, &block)) { \
+		cycles += block.cycles; \
+		instructions += block.instructions - 1; \
+	} else if (!(taken = fastPrefixed(cpu, at, op))) { \
+		goto done; \
+	} else { \
+		cycles += taken; \
+	} \
+	instructions++; \
+	if (_FAST_IO(op) && (ioInterruptRaised || schedNext() < start + budget)) { \
+		goto done; \
+	} \
+	_FAST_NEXT();
+#define _FAST_ROW(row) _FAST_OP(row##0) _FAST_OP(row##1) _FAST_OP(row##2) _FAST_OP(row##3) \
+	_FAST_OP(row##4) _FAST_OP(row##5) _FAST_OP(row##6) _FAST_OP(row##7) \
+	_FAST_OP(row##8) _FAST_OP(row##9) _FAST_OP(row##A) _FAST_OP(row##B) \
+	_FAST_OP(row##C) _FAST_OP(row##D) _FAST_OP(row##E) _FAST_OP(row##F)
+#define _FAST_LABEL(op) &&fast_##op,
+#define _FAST_LABELS(row) _FAST_LABEL(row##0) _FAST_LABEL(row##1) _FAST_LABEL(row##2) _FAST_LABEL(row##3) \
+	_FAST_LABEL(row##4) _FAST_LABEL(row##5) _FAST_LABEL(row##6) _FAST_LABEL(row##7) \
+	_FAST_LABEL(row##8) _FAST_LABEL(row##9) _FAST_LABEL(row##A) _FAST_LABEL(row##B) \
+	_FAST_LABEL(row##C) _FAST_LABEL(row##D) _FAST_LABEL(row##E) _FAST_LABEL(row##F)
+
+bool fastRun(z80_t* cpu, uint16_t pc, uint64_t budget, z80BlockResult_t* result) {
+	static const void* const handlers[256] = {
+		_FAST_LABELS(0x0) _FAST_LABELS(0x1) _FAST_LABELS(0x2) _FAST_LABELS(0x3)
+		_FAST_LABELS(0x4) _FAST_LABELS(0x5) _FAST_LABELS(0x6) _FAST_LABELS(0x7)
+		_FAST_LABELS(0x8) _FAST_LABELS(0x9) _FAST_LABELS(0xA) _FAST_LABELS(0xB)
+		_FAST_LABELS(0xC) _FAST_LABELS(0xD) _FAST_LABELS(0xE) _FAST_LABELS(0xF)
+	};
+	uint64_t cycles = 0;
+	uint64_t instructions = 0;
+	uint32_t taken;
+	z80BlockResult_t block;
+	uint16_t at;
+	uint8_t opcode;
+	// past the fetch that's already on the bus, for when nothing runs
+	const uint16_t fetched = cpu->pc;
+	const uint64_t start = totalTicks;
+	cpu->pc = pc;
+	ioInterruptRaised = false;
+	_FAST_NEXT();
+	_FAST_ROW(0x0) _FAST_ROW(0x1) _FAST_ROW(0x2) _FAST_ROW(0x3)
+	_FAST_ROW(0x4) _FAST_ROW(0x5) _FAST_ROW(0x6) _FAST_ROW(0x7)
+	_FAST_ROW(0x8) _FAST_ROW(0x9) _FAST_ROW(0xA) _FAST_ROW(0xB)
+	_FAST_ROW(0xC) _FAST_ROW(0xD) _FAST_ROW(0xE) _FAST_ROW(0xF)
+done:
+	totalTicks = start;
+	if (!instructions) {
+		cpu->pc = fetched;
+		return false;
+	}
+	result->cycles = cycles;
+	result->instructions = instructions;
+	fastStats.instructions += instructions;
+	fastStats.runs++;
+	return true;
+}
+
+#undef _FAST_NEXT
+#undef _FAST_IO
+#undef _FAST_OP
+#undef _FAST_ROW
+#undef _FAST_LABEL
+#undef _FAST_LABELS
+
+#endif // CHIPS_IMPL
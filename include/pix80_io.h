@@ -0,0 +1,107 @@
+#pragma once
+/*
+ * Pix80 I/O port dispatch
+ *
+ * Every one of the 256 ports has a device entry with a read and a
+ * write callback and a context pointer for the device's state. Ports
+ * nobody registered for point at handlers that only count accesses,
+ * so dispatching an IN or OUT is always exactly one indirect call.
+ *
+ * Devices attach themselves with ioRegister(), usually from an
+ * attach function in their own module. The callbacks get the full
+ * 16 bit port address, the upper half is whatever was in A or B.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint8_t (*ioReadFn)(void* context, uint16_t port);
+typedef void (*ioWriteFn)(void* context, uint16_t port, uint8_t data);
+
+// Each direction carries its own context, so a port can be
+// half assigned and still count the other direction
+typedef struct {
+	ioReadFn read;
+	void* readContext;
+	ioWriteFn write;
+	void* writeContext;
+	const char* name;
+} ioDevice_t;
+
+typedef struct {
+	uint64_t reads;
+	uint64_t writes;
+} ioUnassigned_t;
+
+extern ioDevice_t ioDevices[256];
+extern ioUnassigned_t ioUnassigned[256];
+// Set when an access raised an interrupt, cores that run I/O without
+// looking at INT stop after that instruction so it's taken in time
+extern bool ioInterruptRaised;
+
+// clear the dispatch table, all ports start out unassigned
+void initIO();
+// attach a device to a port, a NULL callback leaves that direction unassigned
+void ioRegister(uint8_t port, const char* name, ioReadFn read, ioWriteFn write, void* context);
+// attach a device to 'count' consecutive ports
+void ioRegisterRange(uint8_t first, int count, const char* name, ioReadFn read, ioWriteFn write, void* context);
+
+static inline uint8_t ioRead(uint16_t port) {
+	const ioDevice_t* device = &ioDevices[port & 0xFF];
+	return device->read(device->readContext, port);
+}
+
+static inline void ioWrite(uint16_t port, uint8_t data) {
+	const ioDevice_t* device = &ioDevices[port & 0xFF];
+	device->write(device->writeContext, port, data);
+}
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+
+ioDevice_t ioDevices[256];
+ioUnassigned_t ioUnassigned[256];
+bool ioInterruptRaised = false;
+
+static uint8_t unassignedRead(void* context, uint16_t port) {
+	((ioUnassigned_t*)context)->reads++;
+	(void)port;
+	// nothing drives the data bus
+	return 0xFF;
+}
+
+static void unassignedWrite(void* context, uint16_t port, uint8_t data) {
+	((ioUnassigned_t*)context)->writes++;
+	(void)port;
+	(void)data;
+}
+
+void initIO() {
+	for (int port = 0; port < 256; port++) {
+		ioDevices[port].read = unassignedRead;
+		ioDevices[port].readContext = &ioUnassigned[port];
+		ioDevices[port].write = unassignedWrite;
+		ioDevices[port].writeContext = &ioUnassigned[port];
+		ioDevices[port].name = NULL;
+		ioUnassigned[port].reads = ioUnassigned[port].writes = 0;
+	}
+}
+
+void ioRegister(uint8_t port, const char* name, ioReadFn read, ioWriteFn write, void* context) {
+	ioDevice_t* device = &ioDevices[port];
+	device->name = name;
+	device->read = read ? read : unassignedRead;
+	device->readContext = read ? context : &ioUnassigned[port];
+	device->write = write ? write : unassignedWrite;
+	device->writeContext = write ? context : &ioUnassigned[port];
+}
+
+void ioRegisterRange(uint8_t first, int count, const char* name, ioReadFn read, ioWriteFn write, void* context) {
+	for (int i = 0; i < count && first + i < 256; i++) {
+		ioRegister((uint8_t)(first + i), name, read, write, context);
+	}
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,342 @@
+#pragma once
+/*
+ * Pix80 x86-64 JIT
+ *
+ * Translates hot Z80 basic blocks into native code. A block is a run
+ * of instructions from pix80_ops.h, it ends after a branch, before
+ * anything z80_tick() has to do itself (I/O, HALT, DI/EI, prefixes)
+ * and at the end of a 4 KB page. Simple loads and 16 bit INC/DEC are
+ * emitted inline, everything else is a call into a copy of
+ * z80OpExecute() that's specialised for its opcode. Cycle counts are
+ * exact: the fixed T-states of a block are summed up while
+ * translating, only the final branch reports its own.
+ *
+ * Translations are cached by memPageKey() and PC, so the same address
+ * in different banks gets different blocks. The RAM pages that hold
+ * translated code are watched (see pix80_memory.h), a write to one
+ * drops every block on that page, and if a block wrote to itself it
+ * stops right after the write.
+ *
+ * jitRun() only ever starts at an instruction boundary and leaves the
+ * CPU at one, interrupts and I/O are left to the cycle-stepped core.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "z80.h"
+#include "pix80_memory.h"
+#include "pix80_ops.h"
+
+// must be powers of two
+#define JIT_CACHE_SIZE (1 << 14)
+#define JIT_CODE_SIZE (16 << 20)
+// executions of a block's first instruction before it gets translated
+#define JIT_HOT_THRESHOLD 8
+#define JIT_MAX_INSTRUCTIONS 64
+
+typedef struct {
+	uint64_t translated;
+	uint64_t invalidated;
+	uint64_t flushes;
+	uint64_t blocksRun;
+} jitStats_t;
+
+extern jitStats_t jitStats;
+
+// allocate the code buffer and start watching for code writes
+bool jitInit();
+// Run the block at 'pc' if there's a translation for it that takes no
+// more than 'budget' cycles. Afterwards PC is the next instruction,
+// which hasn't been fetched yet.
+bool jitRun(z80_t* cpu, uint16_t pc, uint64_t budget, z80BlockResult_t* result);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+typedef z80BlockResult_t (*jitBlock_t)(z80_t* cpu);
+typedef uint32_t (*jitOp_t)(z80_t* cpu, uint32_t operand);
+
+typedef struct {
+	// memPageKey() << 16 | pc
+	uint32_t key;
+	// jitGeneration of the block's page when it was translated
+	uint32_t generation;
+	jitBlock_t code;
+	uint32_t maxCycles;
+	uint16_t heat;
+} jitEntry_t;
+
+#define JIT_NO_KEY 0xFFFFFFFF
+// heat of a block that can't be translated
+#define JIT_COLD 0xFFFF
+
+jitStats_t jitStats;
+static jitEntry_t jitCache[JIT_CACHE_SIZE];
+// bumped whenever a page's code is written to, [memPageKey()][page]
+static uint32_t jitGeneration[MEM_MAX_BANKS + 1][MEM_NUM_PAGES];
+static uint8_t* jitCode = NULL;
+static size_t jitCodeUsed = 0;
+// set when the running block wrote to translated code
+static bool jitBlockBroken = false;
+
+// One handler per opcode, each with its own inlined copy of z80OpExecute()
+#define _JIT_OP(op) static uint32_t jitOp##op(z80_t* cpu, uint32_t operand) { return z80OpExecute(cpu, op, (uint16_t)operand); }
+#define _JIT_ROW(row) _JIT_OP(row##0) _JIT_OP(row##1) _JIT_OP(row##2) _JIT_OP(row##3) \
+	_JIT_OP(row##4) _JIT_OP(row##5) _JIT_OP(row##6) _JIT_OP(row##7) \
+	_JIT_OP(row##8) _JIT_OP(row##9) _JIT_OP(row##A) _JIT_OP(row##B) \
+	_JIT_OP(row##C) _JIT_OP(row##D) _JIT_OP(row##E) _JIT_OP(row##F)
+_JIT_ROW(0x0) _JIT_ROW(0x1) _JIT_ROW(0x2) _JIT_ROW(0x3)
+_JIT_ROW(0x4) _JIT_ROW(0x5) _JIT_ROW(0x6) _JIT_ROW(0x7)
+_JIT_ROW(0x8) _JIT_ROW(0x9) _JIT_ROW(0xA) _JIT_ROW(0xB)
+_JIT_ROW(0xC) _JIT_ROW(0xD) _JIT_ROW(0xE) _JIT_ROW(0xF)
+#undef _JIT_OP
+#undef _JIT_ROW
+
+#define _JIT_OP(op) jitOp##op,
+#define _JIT_ROW(row) _JIT_OP(row##0) _JIT_OP(row##1) _JIT_OP(row##2) _JIT_OP(row##3) \
+	_JIT_OP(row##4) _JIT_OP(row##5) _JIT_OP(row##6) _JIT_OP(row##7) \
+	_JIT_OP(row##8) _JIT_OP(row##9) _JIT_OP(row##A) _JIT_OP(row##B) \
+	_JIT_OP(row##C) _JIT_OP(row##D) _JIT_OP(row##E) _JIT_OP(row##F)
+static const jitOp_t jitOps[256] = {
+	_JIT_ROW(0x0) _JIT_ROW(0x1) _JIT_ROW(0x2) _JIT_ROW(0x3)
+	_JIT_ROW(0x4) _JIT_ROW(0x5) _JIT_ROW(0x6) _JIT_ROW(0x7)
+	_JIT_ROW(0x8) _JIT_ROW(0x9) _JIT_ROW(0xA) _JIT_ROW(0xB)
+	_JIT_ROW(0xC) _JIT_ROW(0xD) _JIT_ROW(0xE) _JIT_ROW(0xF)
+};
+#undef _JIT_OP
+#undef _JIT_ROW
+
+// Offsets into z80_t for the inline code, B C D E H L - A like the opcode's register fields
+static const uint8_t jitReg8[8] = {
+	offsetof(z80_t, b), offsetof(z80_t, c), offsetof(z80_t, d), offsetof(z80_t, e),
+	offsetof(z80_t, h), offsetof(z80_t, l), 0, offsetof(z80_t, a)
+};
+static const uint8_t jitReg16[4] = {
+	offsetof(z80_t, bc), offsetof(z80_t, de), offsetof(z80_t, hl), offsetof(z80_t, sp)
+};
+
+//-- x86-64 code emission, rbx holds the z80_t* for the whole block --
+
+static uint8_t* jitAt;
+
+static void emit8(uint8_t byte) {
+	*jitAt++ = byte;
+}
+
+static void emit16(uint16_t value) {
+	memcpy(jitAt, &value, 2);
+	jitAt += 2;
+}
+
+static void emit32(uint32_t value) {
+	memcpy(jitAt, &value, 4);
+	jitAt += 4;
+}
+
+static void emit64(uint64_t value) {
+	memcpy(jitAt, &value, 8);
+	jitAt += 8;
+}
+
+// mov word [rbx + pc], value
+static void emitSetPC(uint16_t pc) {
+	emit8(0x66); emit8(0xC7); emit8(0x43); emit8(offsetof(z80_t, pc)); emit16(pc);
+}
+
+// mov eax, cycles / mov edx, instructions / pop rbx / ret
+static void emitReturn(uint32_t cycles, uint32_t instructions) {
+	emit8(0xB8); emit32(cycles);
+	emit8(0xBA); emit32(instructions);
+	emit8(0x5B);
+	emit8(0xC3);
+}
+
+// mov rdi, rbx / mov esi, operand / mov rax, handler / call rax
+static void emitCall(uint8_t opcode, uint16_t operand) {
+	emit8(0x48); emit8(0x89); emit8(0xDF);
+	emit8(0xBE); emit32(operand);
+	emit8(0x48); emit8(0xB8); emit64((uint64_t)(uintptr_t)jitOps[opcode]);
+	emit8(0xFF); emit8(0xD0);
+}
+
+// Leave the block right after an instruction that wrote to translated code
+static void emitBrokenCheck(uint16_t next, uint32_t cycles, uint32_t instructions) {
+	// mov rax, &jitBlockBroken / cmp byte [rax], 0 / je over the exit
+	emit8(0x48); emit8(0xB8); emit64((uint64_t)(uintptr_t)&jitBlockBroken);
+	emit8(0x80); emit8(0x38); emit8(0x00);
+	emit8(0x74); emit8(18);
+	emitSetPC(next);
+	emitReturn(cycles, instructions);
+}
+
+// Simple register loads don't need a call
+static bool emitInline(uint8_t opcode, uint16_t operand) {
+	const uint8_t y = (opcode >> 3) & 7, z = opcode & 7;
+	if (opcode == 0x00) {
+		// NOP
+		return true;
+	}
+	if ((opcode & 0xC0) == 0x40 && y != 6 && z != 6) {
+		// LD r,r': movzx eax, byte [rbx + r'] / mov byte [rbx + r], al
+		emit8(0x0F); emit8(0xB6); emit8(0x43); emit8(jitReg8[z]);
+		emit8(0x88); emit8(0x43); emit8(jitReg8[y]);
+		return true;
+	}
+	if ((opcode & 0xC7) == 0x06 && y != 6) {
+		// LD r,n: mov byte [rbx + r], n
+		emit8(0xC6); emit8(0x43); emit8(jitReg8[y]); emit8((uint8_t)operand);
+		return true;
+	}
+	if ((opcode & 0xCF) == 0x01) {
+		// LD rr,nn: mov word [rbx + rr], nn
+		emit8(0x66); emit8(0xC7); emit8(0x43); emit8(jitReg16[opcode >> 4]); emit16(operand);
+		return true;
+	}
+	if ((opcode & 0xC7) == 0x03) {
+		// INC rr / DEC rr: inc / dec word [rbx + rr]
+		emit8(0x66); emit8(0xFF); emit8((opcode & 0x08) ? 0x4B : 0x43); emit8(jitReg16[opcode >> 4]);
+		return true;
+	}
+	return false;
+}
+
+static void jitCodeWritten(uint16_t address) {
+	const int key = memPageKey(address);
+	jitGeneration[key][address >> MEM_PAGE_SHIFT]++;
+	jitStats.invalidated++;
+	jitBlockBroken = true;
+	// nothing valid is left on the page until it's translated again
+	memWatch(address, false);
+}
+
+bool jitInit() {
+	void* code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED) {
+		return false;
+	}
+	jitCode = (uint8_t*)code;
+	jitCodeUsed = 0;
+	for (int i = 0; i < JIT_CACHE_SIZE; i++) {
+		jitCache[i].key = JIT_NO_KEY;
+		jitCache[i].code = NULL;
+	}
+	memWatchHandler = jitCodeWritten;
+	return true;
+}
+
+// Throw away every translation, only ever done between blocks
+static void jitFlush() {
+	for (int i = 0; i < JIT_CACHE_SIZE; i++) {
+		jitCache[i].key = JIT_NO_KEY;
+		jitCache[i].code = NULL;
+	}
+	jitCodeUsed = 0;
+	jitStats.flushes++;
+}
+
+static bool jitTranslate(jitEntry_t* entry, uint16_t start) {
+	// the longest instruction sequence is well below this
+	if (JIT_CODE_SIZE - jitCodeUsed < JIT_MAX_INSTRUCTIONS * 64 + 64) {
+		jitFlush();
+	}
+	uint8_t* const code = jitCode + jitCodeUsed;
+	jitAt = code;
+	// push rbx / mov rbx, rdi
+	emit8(0x53);
+	emit8(0x48); emit8(0x89); emit8(0xFB);
+
+	const int page = start >> MEM_PAGE_SHIFT;
+	uint32_t pc = start;
+	uint32_t cycles = 0;
+	uint32_t count = 0;
+	bool branched = false;
+	while (count < JIT_MAX_INSTRUCTIONS) {
+		const uint8_t opcode = readMappedMemory(pc);
+		const uint8_t info = z80OpInfo[opcode];
+		const uint32_t length = info & Z80_OP_LENGTH;
+		if (!(info & Z80_OP_ATOMIC) || ((pc + length - 1) >> MEM_PAGE_SHIFT) != (uint32_t)page) {
+			break;
+		}
+		const uint16_t operand = readMappedMemory(pc + 1) | (readMappedMemory(pc + 2) << 8);
+		const uint16_t next = (uint16_t)(pc + length);
+		count++;
+		if (info & Z80_OP_BRANCH) {
+			// branches work on the PC past themselves and report their own cycles
+			emitSetPC(next);
+			emitCall(opcode, operand);
+			// add eax, cycles / mov edx, count / pop rbx / ret
+			emit8(0x05); emit32(cycles);
+			emit8(0xBA); emit32(count);
+			emit8(0x5B);
+			emit8(0xC3);
+			cycles += z80OpCycles[opcode];
+			branched = true;
+			break;
+		}
+		if (!emitInline(opcode, operand)) {
+			emitCall(opcode, operand);
+		}
+		cycles += z80OpCycles[opcode];
+		if (info & Z80_OP_WRITE) {
+			emitBrokenCheck(next, cycles, count);
+		}
+		pc = next;
+	}
+	if (count == 0) {
+		return false;
+	}
+	if (!branched) {
+		emitSetPC((uint16_t)pc);
+		emitReturn(cycles, count);
+	}
+
+	jitCodeUsed += (size_t)(jitAt - code);
+	entry->code = (jitBlock_t)(void*)code;
+	entry->maxCycles = cycles;
+	jitStats.translated++;
+	// writes to the page have to drop the translation
+	memWatch(start, true);
+	return true;
+}
+
+bool jitRun(z80_t* cpu, uint16_t pc, uint64_t budget, z80BlockResult_t* result) {
+	const int key = memPageKey(pc);
+	const uint32_t generation = jitGeneration[key][pc >> MEM_PAGE_SHIFT];
+	jitEntry_t* entry = &jitCache[(pc ^ (key * 0x9E5)) & (JIT_CACHE_SIZE - 1)];
+	if (entry->key != ((uint32_t)key << 16 | pc) || entry->generation != generation) {
+		entry->key = (uint32_t)key << 16 | pc;
+		entry->generation = generation;
+		entry->code = NULL;
+		entry->heat = 0;
+	}
+	if (!entry->code) {
+		if (entry->heat == JIT_COLD || ++entry->heat < JIT_HOT_THRESHOLD) {
+			return false;
+		}
+		const bool translated = jitTranslate(entry, pc);
+		// translating may have flushed the cache, entry included
+		entry->key = (uint32_t)key << 16 | pc;
+		entry->generation = generation;
+		if (!translated) {
+			entry->heat = JIT_COLD;
+			return false;
+		}
+	}
+	if (entry->maxCycles > budget) {
+		return false;
+	}
+	cpu->pc = pc;
+	jitBlockBroken = false;
+	*result = entry->code(cpu);
+	// one refresh cycle per opcode fetch
+	cpu->r = (cpu->r & 0x80) | ((cpu->r + result->instructions) & 0x7F);
+	jitStats.blocksRun++;
+	return true;
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,214 @@
+#pragma once
+/*
+ * Pix80 HD44780 character LCD
+ *
+ * Troy Schrapel's vrEmuLcd on two I/O ports from the one it's
+ * attached to, A0 is the RS line:
+ *
+ *   +0  instruction register, writes are commands, reads give the
+ *       address counter with the busy flag, which is never set
+ *   +1  data register, DDRAM or CGRAM at the address counter
+ *
+ * vrEmuLcd only redraws its pixels when vrEmuLcdUpdatePixels() is
+ * called, and then it redraws all of them. The device keeps a dirty
+ * flag that anything changing what's shown sets: DDRAM and CGRAM
+ * writes, the commands that clear, shift or switch the display and
+ * cursor moves while the cursor is on. Once a frame, an event on the
+ * scheduler calls lcdRefresh(), which only redraws when the flag is
+ * set, so firmware that pours bytes into the LCD costs one redraw per
+ * frame at most and a static display none. A blinking cursor changes
+ * on its own, it keeps the display dirty. Its blink runs on the host's
+ * clock, not on emulated time, so lcdStill() draws the display without
+ * the cursor and says where the cursor is instead, for anything that
+ * has to come out the same every run. Whatever wants to follow
+ * the display frame by frame hooks into the frame event with
+ * lcdOnFrame() and is told whether the frame was redrawn.
+ *
+ * Only the header of vrEmuLcd is bundled. compile.sh builds the LCD
+ * in (PIX80_LCD) when include/vrEmuLcd.c from
+ * https://github.com/visrealm/VrEmuLcd is there.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "pix80_io.h"
+#include "pix80_sched.h"
+#ifndef VR_LCD_EMU_STATIC
+#define VR_LCD_EMU_STATIC 1
+#endif
+#include "vrEmuLcd.h"
+
+#define LCD_PORTS 2
+#define LCD_FRAME_HZ 60
+#define LCD_FRAME_HOOKS 4
+
+// called after every frame, 'redrawn' if the pixels changed
+typedef void (*lcdFrameFn)(uint64_t frame, uint64_t cycle, bool redrawn);
+
+typedef struct {
+	VrEmuLcd* display;
+	uint8_t port;
+	int cols;
+	int rows;
+	// the last display control command, display, cursor and blink bits
+	uint8_t displayControl;
+	bool dirty;
+	uint64_t framePeriod;
+	schedEvent_t frame;
+	lcdFrameFn frameHooks[LCD_FRAME_HOOKS];
+	int frameHookCount;
+	uint64_t frames;
+	uint64_t commands;
+	uint64_t dataWrites;
+	// frames that redrew the pixels
+	uint64_t updates;
+} lcd_t;
+
+extern lcd_t lcd;
+
+// a cols x rows display refreshed every 'framePeriod' cycles, false if it can't be made
+bool lcdInit(int cols, int rows, uint64_t framePeriod);
+// attach the registers to LCD_PORTS ports from 'port' on
+void attachLCD(uint8_t port);
+// redraw the pixels if anything changed since the last time, true if it did
+bool lcdRefresh();
+// call 'fn' after every frame, false if there are too many hooks
+bool lcdOnFrame(lcdFrameFn fn);
+// copy the pixel states, vrEmuLcdNumPixels() of them row by row
+void lcdPixels(char* pixels);
+// the same without the cursor, the address counter and display control
+// bits when it shows, 0 when it doesn't
+uint16_t lcdStill(char* pixels);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+
+lcd_t lcd;
+
+#define LCD_DISPLAY_ON 0x04
+#define LCD_CURSOR_ON 0x02
+#define LCD_BLINK_ON 0x01
+
+static inline bool lcdCursorShown() {
+	return (lcd.displayControl & LCD_DISPLAY_ON) && (lcd.displayControl & (LCD_CURSOR_ON | LCD_BLINK_ON));
+}
+
+bool lcdRefresh() {
+	const bool blinking = (lcd.displayControl & (LCD_DISPLAY_ON | LCD_BLINK_ON)) == (LCD_DISPLAY_ON | LCD_BLINK_ON);
+	if (!lcd.dirty && !blinking) {
+		return false;
+	}
+	vrEmuLcdUpdatePixels(lcd.display);
+	lcd.dirty = false;
+	lcd.updates++;
+	return true;
+}
+
+static void lcdFrame(void* context, uint64_t cycle) {
+	(void)context;
+	const bool redrawn = lcdRefresh();
+	for (int i = 0; i < lcd.frameHookCount; i++) {
+		lcd.frameHooks[i](lcd.frames, cycle, redrawn);
+	}
+	lcd.frames++;
+	schedAt(&lcd.frame, cycle + lcd.framePeriod);
+}
+
+bool lcdOnFrame(lcdFrameFn fn) {
+	if (lcd.frameHookCount == LCD_FRAME_HOOKS) {
+		return false;
+	}
+	lcd.frameHooks[lcd.frameHookCount++] = fn;
+	return true;
+}
+
+void lcdPixels(char* pixels) {
+	int width, height;
+	vrEmuLcdNumPixels(lcd.display, &width, &height);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			*pixels++ = vrEmuLcdPixelState(lcd.display, x, y);
+		}
+	}
+}
+
+uint16_t lcdStill(char* pixels) {
+	if (!lcdCursorShown()) {
+		lcdPixels(pixels);
+		return 0;
+	}
+	// hide it for one redraw, then put it back for everyone else
+	vrEmuLcdSendCommand(lcd.display, 0x08 | LCD_DISPLAY_ON);
+	vrEmuLcdUpdatePixels(lcd.display);
+	lcdPixels(pixels);
+	vrEmuLcdSendCommand(lcd.display, 0x08 | lcd.displayControl);
+	vrEmuLcdUpdatePixels(lcd.display);
+	return (uint16_t)((vrEmuLcdReadAddress(lcd.display) & 0x7F) << 8 | lcd.displayControl);
+}
+
+// Whether a command changes what's on the display
+static bool lcdCommandShows(uint8_t command) {
+	if (command & 0xC0) {
+		// set DDRAM or CGRAM address, moves the cursor
+		return lcdCursorShown();
+	}
+	if (command >= 0x08) {
+		// display control, cursor or display shift, function set
+		return true;
+	}
+	// entry mode only affects later writes, clear and home do show
+	return command < 0x04;
+}
+
+static uint8_t lcdRead(void* context, uint16_t port) {
+	(void)context;
+	if (((uint8_t)(port - lcd.port)) == 0) {
+		return vrEmuLcdReadAddress(lcd.display) & 0x7F;
+	}
+	// reading moves the address counter along too
+	lcd.dirty |= lcdCursorShown();
+	return vrEmuLcdReadByte(lcd.display);
+}
+
+static void lcdWrite(void* context, uint16_t port, uint8_t data) {
+	(void)context;
+	if (((uint8_t)(port - lcd.port)) == 0) {
+		lcd.commands++;
+		if ((data & 0xF8) == 0x08) {
+			lcd.displayControl = data & 0x07;
+		}
+		lcd.dirty |= lcdCommandShows(data);
+		vrEmuLcdSendCommand(lcd.display, data);
+	} else {
+		lcd.dataWrites++;
+		lcd.dirty = true;
+		vrEmuLcdWriteByte(lcd.display, data);
+	}
+}
+
+bool lcdInit(int cols, int rows, uint64_t framePeriod) {
+	lcd.display = vrEmuLcdNew(cols, rows, EmuLcdRomA00);
+	if (!lcd.display) {
+		return false;
+	}
+	lcd.cols = cols;
+	lcd.rows = rows;
+	lcd.displayControl = 0;
+	// draw the blank display once
+	lcd.dirty = true;
+	lcd.framePeriod = framePeriod ? framePeriod : 1;
+	lcd.frames = lcd.commands = lcd.dataWrites = lcd.updates = 0;
+	lcd.frameHookCount = 0;
+	schedInit(&lcd.frame, "lcd frame", lcdFrame, NULL);
+	schedAt(&lcd.frame, totalTicks + lcd.framePeriod);
+	return true;
+}
+
+void attachLCD(uint8_t port) {
+	lcd.port = port;
+	ioRegisterRange(port, LCD_PORTS, "lcd", lcdRead, lcdWrite, &lcd);
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,168 @@
+#pragma once
+/*
+ * Pix80 LCD frame hashes
+ *
+ * For golden image tests. Every LCD frame boundary gives a line with
+ * the cycle and a 64-bit hash of what the display shows:
+ *
+ *   <cycle> <hash, 16 hex digits>
+ *
+ * The hash is over the pixel states, border included, so it covers
+ * DDRAM, CGRAM and the display shift as far as they show. The pixels
+ * are drawn without the cursor, whose blink isn't on emulated time,
+ * and the cursor goes in as its address and display control bits.
+ * The lines go to a file if one's given, and are compared one by one
+ * against a golden file, a run written earlier, as they're made. The
+ * first line that differs is the mismatch, lcdHashFrame() says so and
+ * the run can stop right there rather than at the end. A frame past
+ * the end of the golden file is a mismatch too, and so are golden
+ * lines still left when the run stops, lcdHashClose() says so: the
+ * run has to show exactly the frames the golden file has.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct {
+	FILE* file;
+	const char* golden;
+	size_t goldenLength;
+	size_t goldenPos;
+	uint64_t frames;
+	uint64_t compared;
+	// golden lines the run never got to
+	uint64_t missed;
+	bool mismatch;
+	bool writeFailed;
+} lcdHash_t;
+
+extern lcdHash_t lcdHash;
+
+// 64-bit hash of 'count' pixel states
+uint64_t lcdHashPixels(const char* pixels, size_t count);
+// write the hashes to 'path' and compare them with 'goldenPath', either can be NULL
+bool lcdHashOpen(const char* path, const char* goldenPath);
+// the display shows something hashing to 'hash' at 'cycle', false on a mismatch
+bool lcdHashFrame(uint64_t cycle, uint64_t hash);
+// false on a mismatch, golden lines left over or a hash file that came out short
+bool lcdHashClose();
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <stdlib.h>
+#include <string.h>
+#include "pix80_loader.h"
+
+lcdHash_t lcdHash;
+
+uint64_t lcdHashPixels(const char* pixels, size_t count) {
+	uint64_t hash = 0x9E3779B97F4A7C15ULL ^ count;
+	size_t i = 0;
+	// eight at a time, then whatever is left
+	for (; i + 8 <= count; i += 8) {
+		uint64_t word;
+		memcpy(&word, pixels + i, sizeof(word));
+		hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+		hash ^= hash >> 32;
+	}
+	for (; i < count; i++) {
+		hash = (hash ^ (uint8_t)pixels[i]) * 0xFF51AFD7ED558CCDULL;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+bool lcdHashOpen(const char* path, const char* goldenPath) {
+	lcdHash.file = NULL;
+	lcdHash.golden = NULL;
+	lcdHash.goldenLength = lcdHash.goldenPos = 0;
+	lcdHash.frames = lcdHash.compared = lcdHash.missed = 0;
+	lcdHash.mismatch = lcdHash.writeFailed = false;
+	if (goldenPath) {
+		lcdHash.golden = (const char*)mapFile(goldenPath, &lcdHash.goldenLength);
+		if (!lcdHash.golden) {
+			return false;
+		}
+	}
+	if (path) {
+		lcdHash.file = fopen(path, "w");
+		if (!lcdHash.file) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The next line of the golden file, false when it's used up
+static bool lcdHashGolden(uint64_t* cycle, uint64_t* hash) {
+	char line[64];
+	while (lcdHash.goldenPos < lcdHash.goldenLength) {
+		const char* start = lcdHash.golden + lcdHash.goldenPos;
+		const char* end = (const char*)memchr(start, '\n', lcdHash.goldenLength - lcdHash.goldenPos);
+		const size_t length = end ? (size_t)(end - start) : lcdHash.goldenLength - lcdHash.goldenPos;
+		lcdHash.goldenPos += length + (end ? 1 : 0);
+		if (length == 0 || length >= sizeof(line)) {
+			continue;
+		}
+		memcpy(line, start, length);
+		line[length] = '\0';
+		unsigned long long goldenCycle, goldenHash;
+		if (sscanf(line, "%llu %llx", &goldenCycle, &goldenHash) == 2) {
+			*cycle = goldenCycle;
+			*hash = goldenHash;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool lcdHashFrame(uint64_t cycle, uint64_t hash) {
+	if (lcdHash.file) {
+		fprintf(lcdHash.file, "%llu %016llx\n", (unsigned long long)cycle, (unsigned long long)hash);
+	}
+	lcdHash.frames++;
+	uint64_t goldenCycle, goldenHash;
+	if (lcdHash.mismatch || !lcdHash.golden) {
+		return !lcdHash.mismatch;
+	}
+	if (!lcdHashGolden(&goldenCycle, &goldenHash)) {
+		fprintf(stderr, "LCD frame %llu at cycle %llu is past the end of the golden file\n",
+			(unsigned long long)(lcdHash.frames - 1), (unsigned long long)cycle);
+		lcdHash.mismatch = true;
+		return false;
+	}
+	lcdHash.compared++;
+	if (goldenCycle != cycle || goldenHash != hash) {
+		fprintf(stderr, "LCD frame %llu differs: %016llx at cycle %llu, the golden file has %016llx at cycle %llu\n",
+			(unsigned long long)(lcdHash.frames - 1), (unsigned long long)hash, (unsigned long long)cycle,
+			(unsigned long long)goldenHash, (unsigned long long)goldenCycle);
+		lcdHash.mismatch = true;
+		return false;
+	}
+	return true;
+}
+
+bool lcdHashClose() {
+	if (lcdHash.file) {
+		lcdHash.writeFailed = ferror(lcdHash.file) != 0;
+		lcdHash.writeFailed |= fclose(lcdHash.file) != 0;
+		lcdHash.file = NULL;
+	}
+	uint64_t goldenCycle, goldenHash;
+	while (lcdHash.golden && !lcdHash.mismatch && lcdHashGolden(&goldenCycle, &goldenHash)) {
+		lcdHash.missed++;
+	}
+	if (lcdHash.missed) {
+		fprintf(stderr, "The run stopped before %llu more frames of the golden file\n", (unsigned long long)lcdHash.missed);
+		lcdHash.mismatch = true;
+	}
+	return !lcdHash.mismatch && !lcdHash.writeFailed;
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,330 @@
+#pragma once
+/*
+ * Pix80 LCD frame stream
+ *
+ * Records what the LCD showed over a run, for checking it headless.
+ * Only frames the LCD redrew are looked at, each one is compared to
+ * the last one written and only the rectangles that changed go into
+ * the file, so a static display costs nothing and a changing one a
+ * few bytes per frame. The display is cut into bands of
+ * LCD_STREAM_BAND pixel rows, every band with a change gets one
+ * rectangle around it.
+ *
+ * File format, all numbers little endian, varints 7 bits a byte:
+ *
+ *   header  "PIX80LC1", uint16 width, uint16 height, uint32 cycles
+ *           per frame, border mask (width * height bits, 1 where the
+ *           display has a pixel)
+ *   frame   varint frames since the last one written (from frame 0),
+ *           varint cycles since the last one written, varint
+ *           rectangle count, then for each rectangle varint x, y,
+ *           width, height and its pixels, 1 bit each, 1 on
+ *   ...
+ *
+ * Bit arrays are row by row, most significant bit first, padded to a
+ * byte. Before the first frame every pixel is off.
+ *
+ * lcdStreamRender() turns a stream back into one PPM image per frame
+ * written, frames in between look like the one before.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define LCD_STREAM_BAND 8
+// plenty for the four rows an HD44780 drives
+#define LCD_STREAM_MAX_BANDS 16
+// screen pixels per LCD pixel in rendered images
+#define LCD_RENDER_SCALE 4
+
+typedef struct {
+	FILE* file;
+	int width;
+	int height;
+	// pixel states as vrEmuLcdPixelState() gives them, -1 no pixel
+	char* previous;
+	uint64_t lastFrame;
+	uint64_t lastCycle;
+	uint64_t framesWritten;
+	uint64_t rectsWritten;
+} lcdStream_t;
+
+extern lcdStream_t lcdStream;
+
+// create the stream file for a width x height display showing 'pixels' now
+bool lcdStreamOpen(const char* path, int width, int height, const char* pixels, uint64_t framePeriod);
+// frame number 'frame' at 'cycle' shows 'pixels', write what changed
+void lcdStreamFrame(uint64_t frame, uint64_t cycle, const char* pixels);
+// false if the stream file came out short
+bool lcdStreamClose();
+// write every frame of a stream to <prefix><frame number>.ppm
+bool lcdStreamRender(const char* path, const char* prefix);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <stdlib.h>
+#include <string.h>
+
+lcdStream_t lcdStream;
+
+static const char lcdStreamMagic[8] = { 'P', 'I', 'X', '8', '0', 'L', 'C', '1' };
+
+static void lcdStreamVarint(uint64_t value) {
+	while (value >= 0x80) {
+		fputc((int)((value & 0x7F) | 0x80), lcdStream.file);
+		value >>= 7;
+	}
+	fputc((int)value, lcdStream.file);
+}
+
+// 'count' bits from 'bit(i)', most significant first
+#define LCD_STREAM_PUT_BITS(count, bit) \
+	do { \
+		uint8_t byte = 0; \
+		int filled = 0; \
+		for (int i = 0; i < (count); i++) { \
+			byte = (uint8_t)((byte << 1) | ((bit) ? 1 : 0)); \
+			if (++filled == 8) { \
+				fputc(byte, lcdStream.file); \
+				byte = 0; \
+				filled = 0; \
+			} \
+		} \
+		if (filled) { \
+			fputc(byte << (8 - filled), lcdStream.file); \
+		} \
+	} while (0)
+
+bool lcdStreamOpen(const char* path, int width, int height, const char* pixels, uint64_t framePeriod) {
+	if (height > LCD_STREAM_MAX_BANDS * LCD_STREAM_BAND) {
+		return false;
+	}
+	lcdStream.file = fopen(path, "wb");
+	if (!lcdStream.file) {
+		return false;
+	}
+	lcdStream.width = width;
+	lcdStream.height = height;
+	lcdStream.previous = (char*)malloc((size_t)width * height);
+	if (!lcdStream.previous) {
+		fclose(lcdStream.file);
+		lcdStream.file = NULL;
+		return false;
+	}
+	// what a reader starts from: the border and every pixel off
+	for (int i = 0; i < width * height; i++) {
+		lcdStream.previous[i] = pixels[i] < 0 ? -1 : 0;
+	}
+	lcdStream.lastFrame = lcdStream.lastCycle = 0;
+	lcdStream.framesWritten = lcdStream.rectsWritten = 0;
+	const uint8_t header[8] = {
+		(uint8_t)width, (uint8_t)(width >> 8), (uint8_t)height, (uint8_t)(height >> 8),
+		(uint8_t)framePeriod, (uint8_t)(framePeriod >> 8), (uint8_t)(framePeriod >> 16), (uint8_t)(framePeriod >> 24)
+	};
+	fwrite(lcdStreamMagic, 1, sizeof(lcdStreamMagic), lcdStream.file);
+	fwrite(header, 1, sizeof(header), lcdStream.file);
+	LCD_STREAM_PUT_BITS(width * height, pixels[i] >= 0);
+	return true;
+}
+
+void lcdStreamFrame(uint64_t frame, uint64_t cycle, const char* pixels) {
+	if (!lcdStream.file) {
+		return;
+	}
+	const int width = lcdStream.width;
+	// the changed area of each band, empty where left > right
+	const int bands = (lcdStream.height + LCD_STREAM_BAND - 1) / LCD_STREAM_BAND;
+	int left[LCD_STREAM_MAX_BANDS], right[LCD_STREAM_MAX_BANDS], top[LCD_STREAM_MAX_BANDS], bottom[LCD_STREAM_MAX_BANDS];
+	int rects = 0;
+	for (int band = 0; band < bands; band++) {
+		left[band] = width;
+		right[band] = -1;
+		top[band] = lcdStream.height;
+		bottom[band] = -1;
+		const int end = (band + 1) * LCD_STREAM_BAND < lcdStream.height ? (band + 1) * LCD_STREAM_BAND : lcdStream.height;
+		for (int y = band * LCD_STREAM_BAND; y < end; y++) {
+			const char* now = pixels + y * width;
+			const char* before = lcdStream.previous + y * width;
+			if (memcmp(now, before, width) == 0) {
+				continue;
+			}
+			top[band] = top[band] < y ? top[band] : y;
+			bottom[band] = y;
+			for (int x = 0; x < width; x++) {
+				if (now[x] != before[x]) {
+					left[band] = left[band] < x ? left[band] : x;
+					right[band] = right[band] > x ? right[band] : x;
+				}
+			}
+		}
+		rects += right[band] >= 0;
+	}
+	if (!rects) {
+		return;
+	}
+	lcdStreamVarint(frame - lcdStream.lastFrame);
+	lcdStreamVarint(cycle - lcdStream.lastCycle);
+	lcdStreamVarint(rects);
+	for (int band = 0; band < bands; band++) {
+		if (right[band] < 0) {
+			continue;
+		}
+		const int x0 = left[band], y0 = top[band];
+		const int w = right[band] - x0 + 1, h = bottom[band] - y0 + 1;
+		lcdStreamVarint(x0);
+		lcdStreamVarint(y0);
+		lcdStreamVarint(w);
+		lcdStreamVarint(h);
+		LCD_STREAM_PUT_BITS(w * h, pixels[(y0 + i / w) * width + x0 + i % w] > 0);
+		for (int y = y0; y < y0 + h; y++) {
+			memcpy(lcdStream.previous + y * width + x0, pixels + y * width + x0, w);
+		}
+	}
+	lcdStream.lastFrame = frame;
+	lcdStream.lastCycle = cycle;
+	lcdStream.framesWritten++;
+	lcdStream.rectsWritten += rects;
+}
+
+// Every fputc() and fwrite() failure leaves the stream's error flag set
+bool lcdStreamClose() {
+	if (!lcdStream.file) {
+		return true;
+	}
+	const bool ok = ferror(lcdStream.file) == 0;
+	const bool closed = fclose(lcdStream.file) == 0;
+	lcdStream.file = NULL;
+	free(lcdStream.previous);
+	lcdStream.previous = NULL;
+	return ok && closed;
+}
+
+typedef struct {
+	const uint8_t* at;
+	const uint8_t* end;
+	bool ok;
+} lcdStreamReader_t;
+
+static uint64_t lcdStreamGetVarint(lcdStreamReader_t* in) {
+	uint64_t value = 0;
+	for (int shift = 0; in->at < in->end && shift < 64; shift += 7) {
+		const uint8_t byte = *in->at++;
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return value;
+		}
+	}
+	in->ok = false;
+	return 0;
+}
+
+// Unpack 'count' bits into 'out', false if the stream ends first
+static bool lcdStreamGetBits(lcdStreamReader_t* in, int count, uint8_t* out) {
+	const size_t bytes = ((size_t)count + 7) / 8;
+	if ((size_t)(in->end - in->at) < bytes) {
+		in->ok = false;
+		return false;
+	}
+	for (int i = 0; i < count; i++) {
+		out[i] = (in->at[i / 8] >> (7 - i % 8)) & 1;
+	}
+	in->at += bytes;
+	return true;
+}
+
+static bool lcdStreamWritePPM(const char* path, int width, int height, const uint8_t* border, const uint8_t* on) {
+	// the usual green backlit panel
+	static const uint8_t colours[3][3] = { { 0x30, 0x48, 0x10 }, { 0x8C, 0xB4, 0x28 }, { 0x18, 0x28, 0x08 } };
+	FILE* out = fopen(path, "wb");
+	if (!out) {
+		return false;
+	}
+	fprintf(out, "P6\n%d %d\n255\n", width * LCD_RENDER_SCALE, height * LCD_RENDER_SCALE);
+	for (int y = 0; y < height * LCD_RENDER_SCALE; y++) {
+		for (int x = 0; x < width * LCD_RENDER_SCALE; x++) {
+			const int pixel = (y / LCD_RENDER_SCALE) * width + x / LCD_RENDER_SCALE;
+			fwrite(colours[border[pixel] ? 1 + on[pixel] : 0], 1, 3, out);
+		}
+	}
+	const bool ok = ferror(out) == 0;
+	fclose(out);
+	return ok;
+}
+
+bool lcdStreamRender(const char* path, const char* prefix) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+	// streams are small, read it all
+	size_t size = 0, capacity = 1 << 16;
+	uint8_t* data = (uint8_t*)malloc(capacity);
+	size_t got;
+	while (data && (got = fread(data + size, 1, capacity - size, file)) > 0) {
+		size += got;
+		if (size == capacity) {
+			capacity *= 2;
+			data = (uint8_t*)realloc(data, capacity);
+		}
+	}
+	fclose(file);
+	if (!data || size < sizeof(lcdStreamMagic) + 8 || memcmp(data, lcdStreamMagic, sizeof(lcdStreamMagic)) != 0) {
+		free(data);
+		return false;
+	}
+	const uint8_t* header = data + sizeof(lcdStreamMagic);
+	const int width = header[0] | (header[1] << 8);
+	const int height = header[2] | (header[3] << 8);
+	lcdStreamReader_t in = { header + 8, data + size, true };
+	uint8_t* border = (uint8_t*)calloc((size_t)width * height, 1);
+	uint8_t* on = (uint8_t*)calloc((size_t)width * height, 1);
+	uint8_t* rect = (uint8_t*)malloc((size_t)width * height + 1);
+	uint64_t frame = 0;
+	uint64_t written = 0;
+	if (border && on && rect && lcdStreamGetBits(&in, width * height, border)) {
+		while (in.ok && in.at < in.end) {
+			frame += lcdStreamGetVarint(&in);
+			lcdStreamGetVarint(&in);
+			const uint64_t rects = lcdStreamGetVarint(&in);
+			for (uint64_t r = 0; r < rects && in.ok; r++) {
+				const uint64_t x0 = lcdStreamGetVarint(&in), y0 = lcdStreamGetVarint(&in);
+				const uint64_t w = lcdStreamGetVarint(&in), h = lcdStreamGetVarint(&in);
+				// one at a time, a sum of corrupt fields could wrap around
+				if (!in.ok || x0 > (uint64_t)width || w > (uint64_t)width - x0 ||
+					y0 > (uint64_t)height || h > (uint64_t)height - y0 ||
+					!lcdStreamGetBits(&in, (int)(w * h), rect)) {
+					in.ok = false;
+					break;
+				}
+				for (uint64_t y = 0; y < h; y++) {
+					memcpy(on + (y0 + y) * width + x0, rect + y * w, w);
+				}
+			}
+			if (!in.ok) {
+				break;
+			}
+			char name[4096];
+			snprintf(name, sizeof(name), "%s%06llu.ppm", prefix, (unsigned long long)frame);
+			if (!lcdStreamWritePPM(name, width, height, border, on)) {
+				in.ok = false;
+				break;
+			}
+			written++;
+		}
+	} else {
+		in.ok = false;
+	}
+	fprintf(stderr, "Rendered %llu frames to %s*.ppm\n", (unsigned long long)written, prefix);
+	free(border);
+	free(on);
+	free(rect);
+	free(data);
+	return in.ok;
+}
+
+#undef LCD_STREAM_PUT_BITS
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,265 @@
+#pragma once
+/*
+ * Pix80 ROM and bank image loader
+ *
+ * Images are mmap()ed straight into the fixed ROM and the bank pool
+ * of pix80_memory.h instead of being read into them, so startup time
+ * doesn't depend on the image size. Mappings are private, writes to
+ * RAM banks only ever touch a copy of the page, never the file.
+ *
+ * A plain image is laid out like the real board sees it: the first
+ * 16 KB are the fixed ROM, everything after that continues into
+ * bank 0, 1, 2, ...
+ *
+ * A manifest places segments of one or more images explicitly,
+ * one segment per line:
+ *
+ *   # target  offset  file       [file offset]  [length]  [ro|rw]
+ *   rom       0x0000  boot.bin
+ *   bank 4    0x0000  data.bin   0x4000         0x8000    ro
+ *
+ * The offset is relative to the start of the target, a segment may
+ * run on into the following banks. Without a length the segment
+ * covers the rest of the file. Banks are writable unless a segment
+ * in them is marked ro, the fixed ROM is always read only.
+ * Relative file names are relative to the manifest.
+ *
+ * Segments whose offset and file offset are host page aligned have
+ * their whole pages mapped without copying, everything else, like a
+ * partial last page, is read in.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "pix80_memory.h"
+
+// place 'length' bytes of a file at 'offset' into a bank, or the fixed ROM for bank = -1
+bool mapSegment(const char* path, int bank, size_t offset, off_t fileOffset, size_t length, bool readOnly);
+// map a plain image: fixed ROM followed by the banks
+bool loadImage(const char* path);
+// map all segments of a manifest
+bool loadManifest(const char* path);
+// map a whole file read only for a device to consume, NULL on failure
+const uint8_t* mapFile(const char* path, size_t* length);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool readOnlyBanks[MEM_MAX_BANKS];
+
+static bool mapFileAt(int fd, off_t fileSize, uint8_t* dest, off_t fileOffset, size_t length) {
+	const size_t hostPage = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t available = fileSize > fileOffset ? (size_t)(fileSize - fileOffset) : 0;
+	// Past the end of the file the memory just stays zeroed
+	if (length > available) {
+		length = available;
+	}
+	size_t mapped = 0;
+	if (((uintptr_t)dest % hostPage) == 0 && (fileOffset % hostPage) == 0) {
+		// Whole pages only, the zero filled rest of a partial last page
+		// would wipe out whatever another segment put there
+		mapped = length / hostPage * hostPage;
+		if (mapped && mmap(dest, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, fileOffset) == MAP_FAILED) {
+			return false;
+		}
+	}
+	while (mapped < length) {
+		ssize_t got = pread(fd, dest + mapped, length - mapped, fileOffset + (off_t)mapped);
+		if (got <= 0) {
+			return false;
+		}
+		mapped += (size_t)got;
+	}
+	return true;
+}
+
+bool mapSegment(const char* path, int bank, size_t offset, off_t fileOffset, size_t length, bool readOnly) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open %s\n", path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	if (length == 0) {
+		length = st.st_size > fileOffset ? (size_t)(st.st_size - fileOffset) : 0;
+	}
+	if (length == 0) {
+		close(fd);
+		return true;
+	}
+
+	uint8_t* target;
+	size_t targetSize;
+	if (bank < 0) {
+		target = onBoardROM;
+		targetSize = MEM_BANK_SIZE;
+	} else {
+		target = memBankPool + (size_t)bank * MEM_BANK_SIZE;
+		targetSize = (size_t)(memBankCount - bank) * MEM_BANK_SIZE;
+	}
+	if (bank >= memBankCount || offset > targetSize || length > targetSize - offset) {
+		fprintf(stderr, "%s doesn't fit into %s\n", path, bank < 0 ? "the ROM" : "the available banks");
+		close(fd);
+		return false;
+	}
+
+	bool ok = mapFileAt(fd, st.st_size, target + offset, fileOffset, length);
+	// the mapping keeps its own reference to the file
+	close(fd);
+	if (!ok) {
+		fprintf(stderr, "Can't map %s\n", path);
+		return false;
+	}
+	if (bank >= 0 && readOnly) {
+		for (size_t b = offset / MEM_BANK_SIZE; b <= (offset + length - 1) / MEM_BANK_SIZE; b++) {
+			readOnlyBanks[bank + b] = true;
+		}
+	}
+	return true;
+}
+
+// Enforce ROM banks once all segments are in place
+static void protectROM() {
+	mprotect(onBoardROM, MEM_BANK_SIZE, PROT_READ);
+	for (int i = 0; i < memBankCount; i++) {
+		if (readOnlyBanks[i]) {
+			uint8_t* bank = memBankPool + (size_t)i * MEM_BANK_SIZE;
+			mprotect(bank, MEM_BANK_SIZE, PROT_READ);
+			setBank(i, bank, NULL);
+		}
+	}
+}
+
+bool loadImage(const char* path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "Can't open %s\n", path);
+		return false;
+	}
+	size_t size = (size_t)st.st_size;
+	if (!mapSegment(path, -1, 0, 0, size < MEM_BANK_SIZE ? size : MEM_BANK_SIZE, true)) {
+		return false;
+	}
+	// Anything past the fixed ROM continues into the banks
+	if (size > MEM_BANK_SIZE && !mapSegment(path, 0, 0, MEM_BANK_SIZE, size - MEM_BANK_SIZE, false)) {
+		return false;
+	}
+	protectROM();
+	return true;
+}
+
+const uint8_t* mapFile(const char* path, size_t* length) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open %s\n", path);
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+	*length = (size_t)st.st_size;
+	if (*length == 0) {
+		close(fd);
+		// nothing to map, but not an error either
+		static const uint8_t empty = 0;
+		return &empty;
+	}
+	void* data = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Can't map %s\n", path);
+		return NULL;
+	}
+	return (const uint8_t*)data;
+}
+
+bool loadManifest(const char* path) {
+	FILE* manifest = fopen(path, "r");
+	if (!manifest) {
+		fprintf(stderr, "Can't open %s\n", path);
+		return false;
+	}
+	// Relative image paths are relative to the manifest
+	char directory[4096] = "";
+	const char* slash = strrchr(path, '/');
+	if (slash && (size_t)(slash - path + 1) < sizeof(directory)) {
+		memcpy(directory, path, slash - path + 1);
+		directory[slash - path + 1] = '\0';
+	}
+
+	char line[4096];
+	int lineNumber = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), manifest)) {
+		lineNumber++;
+		char* comment = strchr(line, '#');
+		if (comment) {
+			*comment = '\0';
+		}
+		char* fields[7];
+		int count = 0;
+		for (char* field = strtok(line, " \t\r\n"); field && count < 7; field = strtok(NULL, " \t\r\n")) {
+			fields[count++] = field;
+		}
+		if (count == 0) {
+			continue;
+		}
+
+		int bank = -1;
+		int next = 1;
+		if (strcmp(fields[0], "bank") == 0 && count > 1) {
+			bank = (int)strtol(fields[1], NULL, 0);
+			next = 2;
+		} else if (strcmp(fields[0], "rom") != 0) {
+			next = count;
+		}
+		if (count < next + 2 || bank < -1) {
+			fprintf(stderr, "%s:%d: expected 'rom|bank <n> <offset> <file> [file offset] [length] [ro|rw]'\n", path, lineNumber);
+			ok = false;
+			break;
+		}
+		size_t offset = strtoull(fields[next], NULL, 0);
+		const char* file = fields[next + 1];
+		off_t fileOffset = 0;
+		size_t length = 0;
+		bool readOnly = false;
+		for (int i = next + 2, position = 0; i < count; i++) {
+			if (strcmp(fields[i], "ro") == 0) {
+				readOnly = true;
+			} else if (strcmp(fields[i], "rw") == 0) {
+				readOnly = false;
+			} else if (position++ == 0) {
+				fileOffset = (off_t)strtoull(fields[i], NULL, 0);
+			} else {
+				length = strtoull(fields[i], NULL, 0);
+			}
+		}
+
+		char filePath[8192];
+		snprintf(filePath, sizeof(filePath), "%s%s", file[0] == '/' ? "" : directory, file);
+		ok = mapSegment(filePath, bank, offset, fileOffset, length, readOnly);
+	}
+	fclose(manifest);
+	if (ok) {
+		protectROM();
+	}
+	return ok;
+}
+
+#endif // CHIPS_IMPL
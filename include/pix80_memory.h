@@ -0,0 +1,212 @@
+#pragma once
+/*
+ * Pix80 memory map
+ *
+ * The 64 KB address space is split into pages, each of which
+ * holds a direct pointer for reads and one for writes:
+ *
+ *   0x0000 - 0x3FFF  Constant ROM (writes are discarded)
+ *   0x4000 - 0x7FFF  Banking Area, selected through I/O port 0
+ *   0x8000 - 0xFFFF  Constant RAM
+ *
+ * A NULL read pointer makes the page read as 0, a NULL write
+ * pointer discards the write. Pages are only remapped when the
+ * bank register is written, so a bus access is a single lookup.
+ *
+ * The Banking Area shows one 16 KB page out of a pool of banks.
+ * Each bank is RAM or ROM, switching banks only swaps the pointers
+ * of the window's pages, nothing is ever copied.
+ *
+ * A page of RAM can be watched, e.g. because code in it has been
+ * translated. Its write pointer is then NULL and writes take the
+ * slow path, which still stores them and then calls memWatchHandler.
+ * Watches belong to the memory rather than to the address, a watched
+ * bank stays watched while it's switched out.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "pix80_io.h"
+
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_NUM_PAGES (0x10000 >> MEM_PAGE_SHIFT)
+
+#define MEM_ROM_START  0x0000
+#define MEM_BANK_START 0x4000
+#define MEM_RAM_START  0x8000
+#define MEM_BANK_SIZE  0x4000
+
+typedef struct {
+	uint8_t* read;    // NULL reads as 0
+	uint8_t* write;   // NULL discards the write, unless the page is watched
+	uint8_t* watched; // where writes go while the page is watched
+} memPage_t;
+
+extern memPage_t memPages[MEM_NUM_PAGES];
+extern uint8_t* onBoardROM;
+extern uint8_t onBoardRAM[0x10000 - MEM_RAM_START];
+extern int currentBank;
+
+typedef struct {
+	uint8_t* read;  // MEM_BANK_SIZE bytes, NULL reads as 0
+	uint8_t* write; // NULL for ROM banks
+} memBank_t;
+
+#define MEM_MAX_BANKS 256
+
+extern memBank_t memBanks[MEM_MAX_BANKS];
+extern int memBankCount;
+// the pool's RAM, bank n starts at memBankPool + n * MEM_BANK_SIZE
+extern uint8_t* memBankPool;
+
+// map the fixed ROM and RAM areas, the banking area starts out empty
+bool initMemoryMap();
+// select the bank shown in the banking area (I/O port 0)
+void selectBank(uint8_t bank);
+// create a pool of 'count' zeroed RAM banks, returns false if out of memory
+bool initBankPool(int count);
+// replace a bank's memory, pass write = NULL for ROM
+void setBank(int bank, uint8_t* read, uint8_t* write);
+// attach the bank register to an I/O port
+void attachBankSelector(uint8_t port);
+
+// Which memory a page currently shows: 0 for the fixed ROM and RAM,
+// bank + 1 in the Banking Area
+static inline int memPageKey(uint16_t address) {
+	return (address >= MEM_BANK_START && address < MEM_RAM_START) ? currentBank + 1 : 0;
+}
+
+// called after every write to a watched page, the page stays watched
+extern void (*memWatchHandler)(uint16_t address);
+// start or stop watching the memory currently shown at 'address's page
+void memWatch(uint16_t address, bool watch);
+
+static inline uint8_t readMappedMemory(uint16_t address) {
+	const uint8_t* page = memPages[address >> MEM_PAGE_SHIFT].read;
+	return page ? page[address & MEM_PAGE_MASK] : 0;
+}
+
+static inline void writeMappedMemory(uint16_t address, uint8_t data) {
+	const memPage_t* page = &memPages[address >> MEM_PAGE_SHIFT];
+	if (page->write) {
+		page->write[address & MEM_PAGE_MASK] = data;
+	} else if (page->watched) {
+		page->watched[address & MEM_PAGE_MASK] = data;
+		if (memWatchHandler) {
+			memWatchHandler(address);
+		}
+	}
+}
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <sys/mman.h>
+
+memPage_t memPages[MEM_NUM_PAGES];
+// Initalize all memory
+// The ROM is page aligned memory of its own so images can be mapped over it
+uint8_t* onBoardROM = NULL;
+uint8_t onBoardRAM[0x10000 - MEM_RAM_START] = { 0 };
+int currentBank = 0;
+memBank_t memBanks[MEM_MAX_BANKS];
+int memBankCount = 0;
+uint8_t* memBankPool = NULL;
+void (*memWatchHandler)(uint16_t address) = NULL;
+// [memPageKey()][page]
+static bool memWatched[MEM_MAX_BANKS + 1][MEM_NUM_PAGES];
+
+// Point the pages of [start, start+size) at consecutive memory
+static void mapPages(uint16_t start, size_t size, uint8_t* read, uint8_t* write) {
+	for (size_t offset = 0; offset < size; offset += MEM_PAGE_SIZE) {
+		const uint16_t address = (uint16_t)(start + offset);
+		memPage_t* page = &memPages[address >> MEM_PAGE_SHIFT];
+		page->read = read ? read + offset : NULL;
+		page->watched = write ? write + offset : NULL;
+		page->write = memWatched[memPageKey(address)][address >> MEM_PAGE_SHIFT] ? NULL : page->watched;
+	}
+}
+
+bool initMemoryMap() {
+	void* rom = mmap(NULL, MEM_BANK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (rom == MAP_FAILED) {
+		return false;
+	}
+	onBoardROM = (uint8_t*)rom;
+	// Constant ROM, can't write to ROM :^)
+	mapPages(MEM_ROM_START, MEM_BANK_SIZE, onBoardROM, NULL);
+	// Constant RAM
+	mapPages(MEM_RAM_START, sizeof(onBoardRAM), onBoardRAM, onBoardRAM);
+	selectBank(0);
+	return true;
+}
+
+void selectBank(uint8_t bank) {
+	currentBank = bank;
+	// Banking Area
+	// Banks outside of the pool read as 0
+	if (bank < memBankCount) {
+		mapPages(MEM_BANK_START, MEM_BANK_SIZE, memBanks[bank].read, memBanks[bank].write);
+	} else {
+		mapPages(MEM_BANK_START, MEM_BANK_SIZE, NULL, NULL);
+	}
+}
+
+bool initBankPool(int count) {
+	if (count < 0 || count > MEM_MAX_BANKS) {
+		return false;
+	}
+	memBankCount = count;
+	if (count > 0) {
+		// Anonymous memory is zeroed lazily by the OS, so the
+		// pool costs nothing until a bank is actually touched
+		void* pool = mmap(NULL, (size_t)count * MEM_BANK_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (pool == MAP_FAILED) {
+			memBankCount = 0;
+			return false;
+		}
+		memBankPool = (uint8_t*)pool;
+		for (int i = 0; i < count; i++) {
+			memBanks[i].read = memBanks[i].write = memBankPool + (size_t)i * MEM_BANK_SIZE;
+		}
+	}
+	selectBank(currentBank);
+	return true;
+}
+
+void setBank(int bank, uint8_t* read, uint8_t* write) {
+	memBanks[bank].read = read;
+	memBanks[bank].write = write;
+	if (bank == currentBank) {
+		selectBank(currentBank);
+	}
+}
+
+static uint8_t bankSelectorRead(void* context, uint16_t port) {
+	(void)context;
+	(void)port;
+	return (uint8_t)currentBank;
+}
+
+static void bankSelectorWrite(void* context, uint16_t port, uint8_t data) {
+	(void)context;
+	(void)port;
+	selectBank(data);
+}
+
+void attachBankSelector(uint8_t port) {
+	ioRegister(port, "bank", bankSelectorRead, bankSelectorWrite, NULL);
+}
+
+void memWatch(uint16_t address, bool watch) {
+	memPage_t* page = &memPages[address >> MEM_PAGE_SHIFT];
+	memWatched[memPageKey(address)][address >> MEM_PAGE_SHIFT] = watch;
+	page->write = watch ? NULL : page->watched;
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,386 @@
+#pragma once
+/*
+ * Pix80 instruction-atomic Z80 operations
+ *
+ * The whole effect of one Z80 instruction in a single step, for the
+ * backends that don't need to see every bus cycle. They work on the
+ * same z80_t as z80_tick() and go through the same page table, so a
+ * backend can take over from the cycle-stepped core at an instruction
+ * boundary and hand back at the next one. Registers, flags and WZ end
+ * up exactly as z80.h leaves them, and every instruction returns the
+ * number of T-states it takes on the real CPU.
+ *
+ * Only unprefixed instructions that don't touch I/O or interrupt
+ * state are covered, everything else stays with z80_tick().
+ * z80OpInfo[] tells them apart.
+ *
+ * The implementation uses z80.h's private flag helpers, so it only
+ * exists in the file that defines CHIPS_IMPL.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "z80.h"
+#include "pix80_memory.h"
+
+#define Z80_OP_LENGTH (3)      // instruction length in bytes
+#define Z80_OP_BRANCH (1 << 2) // may load PC
+#define Z80_OP_WRITE  (1 << 3) // writes memory
+#define Z80_OP_ATOMIC (1 << 4) // covered by z80OpExecute()
+
+// What a run of instructions took, for the backends that execute whole blocks
+typedef struct {
+	uint64_t cycles;
+	uint64_t instructions;
+} z80BlockResult_t;
+
+extern const uint8_t z80OpInfo[256];
+// T-states of each instruction, the taken case for conditional branches
+extern const uint8_t z80OpCycles[256];
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+
+const uint8_t z80OpInfo[256] = {
+	0x11, 0x13, 0x19, 0x11, 0x11, 0x11, 0x12, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x12, 0x11,
+	0x16, 0x13, 0x19, 0x11, 0x11, 0x11, 0x12, 0x11, 0x16, 0x11, 0x11, 0x11, 0x11, 0x11, 0x12, 0x11,
+	0x16, 0x13, 0x1B, 0x11, 0x11, 0x11, 0x12, 0x11, 0x16, 0x11, 0x13, 0x11, 0x11, 0x11, 0x12, 0x11,
+	0x16, 0x13, 0x1B, 0x11, 0x19, 0x19, 0x1A, 0x11, 0x16, 0x11, 0x13, 0x11, 0x11, 0x11, 0x12, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x01, 0x19, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x15, 0x11, 0x17, 0x17, 0x1F, 0x19, 0x12, 0x1D, 0x15, 0x15, 0x17, 0x01, 0x1F, 0x1F, 0x12, 0x1D,
+	0x15, 0x11, 0x17, 0x02, 0x1F, 0x19, 0x12, 0x1D, 0x15, 0x11, 0x17, 0x02, 0x1F, 0x01, 0x12, 0x1D,
+	0x15, 0x11, 0x17, 0x19, 0x1F, 0x19, 0x12, 0x1D, 0x15, 0x15, 0x17, 0x11, 0x1F, 0x01, 0x12, 0x1D,
+	0x15, 0x11, 0x17, 0x01, 0x1F, 0x19, 0x12, 0x1D, 0x15, 0x11, 0x17, 0x01, 0x1F, 0x01, 0x12, 0x1D,
+};
+
+const uint8_t z80OpCycles[256] = {
+	 4, 10,  7,  6,  4,  4,  7,  4,  4, 11,  7,  6,  4,  4,  7,  4,
+	13, 10,  7,  6,  4,  4,  7,  4, 12, 11,  7,  6,  4,  4,  7,  4,
+	12, 10, 16,  6,  4,  4,  7,  4, 12, 11, 16,  6,  4,  4,  7,  4,
+	12, 10, 13,  6, 11, 11, 10,  4, 12, 11, 13,  6,  4,  4,  7,  4,
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+	 7,  7,  7,  7,  7,  7,  4,  7,  4,  4,  4,  4,  4,  4,  7,  4,
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+	11, 10, 10, 10, 17, 11,  7, 11, 11, 10, 10,  4, 17, 17,  7, 11,
+	11, 10, 10, 11, 17, 11,  7, 11, 11,  4, 10, 11, 17,  4,  7, 11,
+	11, 10, 10, 19, 17, 11,  7, 11, 11,  4, 10,  4, 17,  4,  7, 11,
+	11, 10, 10,  4, 17, 11,  7, 11, 11,  6, 10,  4, 17,  4,  7, 11,
+};
+
+// Condition 'cc' of JP/CALL/RET cc (NZ, Z, NC, C, PO, PE, P, M), JR cc uses the first four
+static inline bool z80OpCondition(const z80_t* cpu, uint8_t cc) {
+	static const uint8_t flag[4] = { Z80_ZF, Z80_CF, Z80_PF, Z80_SF };
+	const bool set = (cpu->f & flag[cc >> 1]) != 0;
+	return (cc & 1) ? set : !set;
+}
+
+// Execute an unprefixed instruction. PC must already point past it,
+// 'operand' holds its n or nn bytes. Returns the T-states it took,
+// 0 for instructions that aren't Z80_OP_ATOMIC (nothing is changed then).
+static inline __attribute__((always_inline)) uint32_t z80OpExecute(z80_t* cpu, uint8_t opcode, uint16_t operand) {
+	uint8_t value;
+	switch (opcode) {
+		case 0x00: return 4; // NOP
+		case 0x01: cpu->bc = operand; return 10; // LD BC,nn
+		case 0x02: writeMappedMemory(cpu->bc, cpu->a); cpu->wzl = cpu->c + 1; cpu->wzh = cpu->a; return 7; // LD (BC),A
+		case 0x03: cpu->bc++; return 6; // INC BC
+		case 0x04: cpu->b = _z80_inc8(cpu, cpu->b); return 4; // INC B
+		case 0x05: cpu->b = _z80_dec8(cpu, cpu->b); return 4; // DEC B
+		case 0x06: cpu->b = (uint8_t)operand; return 7; // LD B,n
+		case 0x07: _z80_rlca(cpu); return 4; // RLCA
+		case 0x08: _z80_ex_af_af2(cpu); return 4; // EX AF,AF'
+		case 0x09: _z80_add16(cpu, cpu->bc); return 11; // ADD HL,BC
+		case 0x0A: cpu->a = readMappedMemory(cpu->bc); cpu->wz = cpu->bc + 1; return 7; // LD A,(BC)
+		case 0x0B: cpu->bc--; return 6; // DEC BC
+		case 0x0C: cpu->c = _z80_inc8(cpu, cpu->c); return 4; // INC C
+		case 0x0D: cpu->c = _z80_dec8(cpu, cpu->c); return 4; // DEC C
+		case 0x0E: cpu->c = (uint8_t)operand; return 7; // LD C,n
+		case 0x0F: _z80_rrca(cpu); return 4; // RRCA
+		case 0x10: // DJNZ d
+			if (--cpu->b == 0) {
+				return 8;
+			}
+			cpu->pc += (int8_t)operand;
+			cpu->wz = cpu->pc;
+			return 13;
+		case 0x11: cpu->de = operand; return 10; // LD DE,nn
+		case 0x12: writeMappedMemory(cpu->de, cpu->a); cpu->wzl = cpu->e + 1; cpu->wzh = cpu->a; return 7; // LD (DE),A
+		case 0x13: cpu->de++; return 6; // INC DE
+		case 0x14: cpu->d = _z80_inc8(cpu, cpu->d); return 4; // INC D
+		case 0x15: cpu->d = _z80_dec8(cpu, cpu->d); return 4; // DEC D
+		case 0x16: cpu->d = (uint8_t)operand; return 7; // LD D,n
+		case 0x17: _z80_rla(cpu); return 4; // RLA
+		case 0x18: cpu->pc += (int8_t)operand; cpu->wz = cpu->pc; return 12; // JR d
+		case 0x19: _z80_add16(cpu, cpu->de); return 11; // ADD HL,DE
+		case 0x1A: cpu->a = readMappedMemory(cpu->de); cpu->wz = cpu->de + 1; return 7; // LD A,(DE)
+		case 0x1B: cpu->de--; return 6; // DEC DE
+		case 0x1C: cpu->e = _z80_inc8(cpu, cpu->e); return 4; // INC E
+		case 0x1D: cpu->e = _z80_dec8(cpu, cpu->e); return 4; // DEC E
+		case 0x1E: cpu->e = (uint8_t)operand; return 7; // LD E,n
+		case 0x1F: _z80_rra(cpu); return 4; // RRA
+		case 0x20: case 0x28: case 0x30: case 0x38: // JR cc,d
+			if (!z80OpCondition(cpu, (opcode >> 3) & 3)) {
+				return 7;
+			}
+			cpu->pc += (int8_t)operand;
+			cpu->wz = cpu->pc;
+			return 12;
+		case 0x21: cpu->hl = operand; return 10; // LD HL,nn
+		case 0x22: // LD (nn),HL
+			cpu->wz = operand;
+			writeMappedMemory(cpu->wz++, cpu->l);
+			writeMappedMemory(cpu->wz, cpu->h);
+			return 16;
+		case 0x23: cpu->hl++; return 6; // INC HL
+		case 0x24: cpu->h = _z80_inc8(cpu, cpu->h); return 4; // INC H
+		case 0x25: cpu->h = _z80_dec8(cpu, cpu->h); return 4; // DEC H
+		case 0x26: cpu->h = (uint8_t)operand; return 7; // LD H,n
+		case 0x27: _z80_daa(cpu); return 4; // DAA
+		case 0x29: _z80_add16(cpu, cpu->hl); return 11; // ADD HL,HL
+		case 0x2A: // LD HL,(nn)
+			cpu->wz = operand;
+			cpu->l = readMappedMemory(cpu->wz++);
+			cpu->h = readMappedMemory(cpu->wz);
+			return 16;
+		case 0x2B: cpu->hl--; return 6; // DEC HL
+		case 0x2C: cpu->l = _z80_inc8(cpu, cpu->l); return 4; // INC L
+		case 0x2D: cpu->l = _z80_dec8(cpu, cpu->l); return 4; // DEC L
+		case 0x2E: cpu->l = (uint8_t)operand; return 7; // LD L,n
+		case 0x2F: _z80_cpl(cpu); return 4; // CPL
+		case 0x31: cpu->sp = operand; return 10; // LD SP,nn
+		case 0x32: // LD (nn),A
+			cpu->wz = operand;
+			writeMappedMemory(cpu->wz++, cpu->a);
+			cpu->wzh = cpu->a;
+			return 13;
+		case 0x33: cpu->sp++; return 6; // INC SP
+		case 0x34: // INC (HL)
+			value = _z80_inc8(cpu, readMappedMemory(cpu->hl));
+			writeMappedMemory(cpu->hl, value);
+			return 11;
+		case 0x35: // DEC (HL)
+			value = _z80_dec8(cpu, readMappedMemory(cpu->hl));
+			writeMappedMemory(cpu->hl, value);
+			return 11;
+		case 0x36: writeMappedMemory(cpu->hl, (uint8_t)operand); return 10; // LD (HL),n
+		case 0x37: _z80_scf(cpu); return 4; // SCF
+		case 0x39: _z80_add16(cpu, cpu->sp); return 11; // ADD HL,SP
+		case 0x3A: cpu->wz = operand; cpu->a = readMappedMemory(cpu->wz++); return 13; // LD A,(nn)
+		case 0x3B: cpu->sp--; return 6; // DEC SP
+		case 0x3C: cpu->a = _z80_inc8(cpu, cpu->a); return 4; // INC A
+		case 0x3D: cpu->a = _z80_dec8(cpu, cpu->a); return 4; // DEC A
+		case 0x3E: cpu->a = (uint8_t)operand; return 7; // LD A,n
+		case 0x3F: _z80_ccf(cpu); return 4; // CCF
+		case 0x40: cpu->b = cpu->b; return 4; // LD B,B
+		case 0x41: cpu->b = cpu->c; return 4; // LD B,C
+		case 0x42: cpu->b = cpu->d; return 4; // LD B,D
+		case 0x43: cpu->b = cpu->e; return 4; // LD B,E
+		case 0x44: cpu->b = cpu->h; return 4; // LD B,H
+		case 0x45: cpu->b = cpu->l; return 4; // LD B,L
+		case 0x46: cpu->b = readMappedMemory(cpu->hl); return 7; // LD B,(HL)
+		case 0x47: cpu->b = cpu->a; return 4; // LD B,A
+		case 0x48: cpu->c = cpu->b; return 4; // LD C,B
+		case 0x49: cpu->c = cpu->c; return 4; // LD C,C
+		case 0x4A: cpu->c = cpu->d; return 4; // LD C,D
+		case 0x4B: cpu->c = cpu->e; return 4; // LD C,E
+		case 0x4C: cpu->c = cpu->h; return 4; // LD C,H
+		case 0x4D: cpu->c = cpu->l; return 4; // LD C,L
+		case 0x4E: cpu->c = readMappedMemory(cpu->hl); return 7; // LD C,(HL)
+		case 0x4F: cpu->c = cpu->a; return 4; // LD C,A
+		case 0x50: cpu->d = cpu->b; return 4; // LD D,B
+		case 0x51: cpu->d = cpu->c; return 4; // LD D,C
+		case 0x52: cpu->d = cpu->d; return 4; // LD D,D
+		case 0x53: cpu->d = cpu->e; return 4; // LD D,E
+		case 0x54: cpu->d = cpu->h; return 4; // LD D,H
+		case 0x55: cpu->d = cpu->l; return 4; // LD D,L
+		case 0x56: cpu->d = readMappedMemory(cpu->hl); return 7; // LD D,(HL)
+		case 0x57: cpu->d = cpu->a; return 4; // LD D,A
+		case 0x58: cpu->e = cpu->b; return 4; // LD E,B
+		case 0x59: cpu->e = cpu->c; return 4; // LD E,C
+		case 0x5A: cpu->e = cpu->d; return 4; // LD E,D
+		case 0x5B: cpu->e = cpu->e; return 4; // LD E,E
+		case 0x5C: cpu->e = cpu->h; return 4; // LD E,H
+		case 0x5D: cpu->e = cpu->l; return 4; // LD E,L
+		case 0x5E: cpu->e = readMappedMemory(cpu->hl); return 7; // LD E,(HL)
+		case 0x5F: cpu->e = cpu->a; return 4; // LD E,A
+		case 0x60: cpu->h = cpu->b; return 4; // LD H,B
+		case 0x61: cpu->h = cpu->c; return 4; // LD H,C
+		case 0x62: cpu->h = cpu->d; return 4; // LD H,D
+		case 0x63: cpu->h = cpu->e; return 4; // LD H,E
+		case 0x64: cpu->h = cpu->h; return 4; // LD H,H
+		case 0x65: cpu->h = cpu->l; return 4; // LD H,L
+		case 0x66: cpu->h = readMappedMemory(cpu->hl); return 7; // LD H,(HL)
+		case 0x67: cpu->h = cpu->a; return 4; // LD H,A
+		case 0x68: cpu->l = cpu->b; return 4; // LD L,B
+		case 0x69: cpu->l = cpu->c; return 4; // LD L,C
+		case 0x6A: cpu->l = cpu->d; return 4; // LD L,D
+		case 0x6B: cpu->l = cpu->e; return 4; // LD L,E
+		case 0x6C: cpu->l = cpu->h; return 4; // LD L,H
+		case 0x6D: cpu->l = cpu->l; return 4; // LD L,L
+		case 0x6E: cpu->l = readMappedMemory(cpu->hl); return 7; // LD L,(HL)
+		case 0x6F: cpu->l = cpu->a; return 4; // LD L,A
+		case 0x70: writeMappedMemory(cpu->hl, cpu->b); return 7; // LD (HL),B
+		case 0x71: writeMappedMemory(cpu->hl, cpu->c); return 7; // LD (HL),C
+		case 0x72: writeMappedMemory(cpu->hl, cpu->d); return 7; // LD (HL),D
+		case 0x73: writeMappedMemory(cpu->hl, cpu->e); return 7; // LD (HL),E
+		case 0x74: writeMappedMemory(cpu->hl, cpu->h); return 7; // LD (HL),H
+		case 0x75: writeMappedMemory(cpu->hl, cpu->l); return 7; // LD (HL),L
+		case 0x77: writeMappedMemory(cpu->hl, cpu->a); return 7; // LD (HL),A
+		case 0x78: cpu->a = cpu->b; return 4; // LD A,B
+		case 0x79: cpu->a = cpu->c; return 4; // LD A,C
+		case 0x7A: cpu->a = cpu->d; return 4; // LD A,D
+		case 0x7B: cpu->a = cpu->e; return 4; // LD A,E
+		case 0x7C: cpu->a = cpu->h; return 4; // LD A,H
+		case 0x7D: cpu->a = cpu->l; return 4; // LD A,L
+		case 0x7E: cpu->a = readMappedMemory(cpu->hl); return 7; // LD A,(HL)
+		case 0x7F: cpu->a = cpu->a; return 4; // LD A,A
+		case 0x80: _z80_add8(cpu, cpu->b); return 4; // ADD B
+		case 0x81: _z80_add8(cpu, cpu->c); return 4; // ADD C
+		case 0x82: _z80_add8(cpu, cpu->d); return 4; // ADD D
+		case 0x83: _z80_add8(cpu, cpu->e); return 4; // ADD E
+		case 0x84: _z80_add8(cpu, cpu->h); return 4; // ADD H
+		case 0x85: _z80_add8(cpu, cpu->l); return 4; // ADD L
+		case 0x86: _z80_add8(cpu, readMappedMemory(cpu->hl)); return 7; // ADD (HL)
+		case 0x87: _z80_add8(cpu, cpu->a); return 4; // ADD A
+		case 0x88: _z80_adc8(cpu, cpu->b); return 4; // ADC B
+		case 0x89: _z80_adc8(cpu, cpu->c); return 4; // ADC C
+		case 0x8A: _z80_adc8(cpu, cpu->d); return 4; // ADC D
+		case 0x8B: _z80_adc8(cpu, cpu->e); return 4; // ADC E
+		case 0x8C: _z80_adc8(cpu, cpu->h); return 4; // ADC H
+		case 0x8D: _z80_adc8(cpu, cpu->l); return 4; // ADC L
+		case 0x8E: _z80_adc8(cpu, readMappedMemory(cpu->hl)); return 7; // ADC (HL)
+		case 0x8F: _z80_adc8(cpu, cpu->a); return 4; // ADC A
+		case 0x90: _z80_sub8(cpu, cpu->b); return 4; // SUB B
+		case 0x91: _z80_sub8(cpu, cpu->c); return 4; // SUB C
+		case 0x92: _z80_sub8(cpu, cpu->d); return 4; // SUB D
+		case 0x93: _z80_sub8(cpu, cpu->e); return 4; // SUB E
+		case 0x94: _z80_sub8(cpu, cpu->h); return 4; // SUB H
+		case 0x95: _z80_sub8(cpu, cpu->l); return 4; // SUB L
+		case 0x96: _z80_sub8(cpu, readMappedMemory(cpu->hl)); return 7; // SUB (HL)
+		case 0x97: _z80_sub8(cpu, cpu->a); return 4; // SUB A
+		case 0x98: _z80_sbc8(cpu, cpu->b); return 4; // SBC B
+		case 0x99: _z80_sbc8(cpu, cpu->c); return 4; // SBC C
+		case 0x9A: _z80_sbc8(cpu, cpu->d); return 4; // SBC D
+		case 0x9B: _z80_sbc8(cpu, cpu->e); return 4; // SBC E
+		case 0x9C: _z80_sbc8(cpu, cpu->h); return 4; // SBC H
+		case 0x9D: _z80_sbc8(cpu, cpu->l); return 4; // SBC L
+		case 0x9E: _z80_sbc8(cpu, readMappedMemory(cpu->hl)); return 7; // SBC (HL)
+		case 0x9F: _z80_sbc8(cpu, cpu->a); return 4; // SBC A
+		case 0xA0: _z80_and8(cpu, cpu->b); return 4; // AND B
+		case 0xA1: _z80_and8(cpu, cpu->c); return 4; // AND C
+		case 0xA2: _z80_and8(cpu, cpu->d); return 4; // AND D
+		case 0xA3: _z80_and8(cpu, cpu->e); return 4; // AND E
+		case 0xA4: _z80_and8(cpu, cpu->h); return 4; // AND H
+		case 0xA5: _z80_and8(cpu, cpu->l); return 4; // AND L
+		case 0xA6: _z80_and8(cpu, readMappedMemory(cpu->hl)); return 7; // AND (HL)
+		case 0xA7: _z80_and8(cpu, cpu->a); return 4; // AND A
+		case 0xA8: _z80_xor8(cpu, cpu->b); return 4; // XOR B
+		case 0xA9: _z80_xor8(cpu, cpu->c); return 4; // XOR C
+		case 0xAA: _z80_xor8(cpu, cpu->d); return 4; // XOR D
+		case 0xAB: _z80_xor8(cpu, cpu->e); return 4; // XOR E
+		case 0xAC: _z80_xor8(cpu, cpu->h); return 4; // XOR H
+		case 0xAD: _z80_xor8(cpu, cpu->l); return 4; // XOR L
+		case 0xAE: _z80_xor8(cpu, readMappedMemory(cpu->hl)); return 7; // XOR (HL)
+		case 0xAF: _z80_xor8(cpu, cpu->a); return 4; // XOR A
+		case 0xB0: _z80_or8(cpu, cpu->b); return 4; // OR B
+		case 0xB1: _z80_or8(cpu, cpu->c); return 4; // OR C
+		case 0xB2: _z80_or8(cpu, cpu->d); return 4; // OR D
+		case 0xB3: _z80_or8(cpu, cpu->e); return 4; // OR E
+		case 0xB4: _z80_or8(cpu, cpu->h); return 4; // OR H
+		case 0xB5: _z80_or8(cpu, cpu->l); return 4; // OR L
+		case 0xB6: _z80_or8(cpu, readMappedMemory(cpu->hl)); return 7; // OR (HL)
+		case 0xB7: _z80_or8(cpu, cpu->a); return 4; // OR A
+		case 0xB8: _z80_cp8(cpu, cpu->b); return 4; // CP B
+		case 0xB9: _z80_cp8(cpu, cpu->c); return 4; // CP C
+		case 0xBA: _z80_cp8(cpu, cpu->d); return 4; // CP D
+		case 0xBB: _z80_cp8(cpu, cpu->e); return 4; // CP E
+		case 0xBC: _z80_cp8(cpu, cpu->h); return 4; // CP H
+		case 0xBD: _z80_cp8(cpu, cpu->l); return 4; // CP L
+		case 0xBE: _z80_cp8(cpu, readMappedMemory(cpu->hl)); return 7; // CP (HL)
+		case 0xBF: _z80_cp8(cpu, cpu->a); return 4; // CP A
+		case 0xC0: case 0xC8: case 0xD0: case 0xD8: case 0xE0: case 0xE8: case 0xF0: case 0xF8: // RET cc
+			if (!z80OpCondition(cpu, (opcode >> 3) & 7)) {
+				return 5;
+			}
+			cpu->wzl = readMappedMemory(cpu->sp++);
+			cpu->wzh = readMappedMemory(cpu->sp++);
+			cpu->pc = cpu->wz;
+			return 11;
+		case 0xC1: cpu->c = readMappedMemory(cpu->sp++); cpu->b = readMappedMemory(cpu->sp++); return 10; // POP BC
+		case 0xD1: cpu->e = readMappedMemory(cpu->sp++); cpu->d = readMappedMemory(cpu->sp++); return 10; // POP DE
+		case 0xE1: cpu->l = readMappedMemory(cpu->sp++); cpu->h = readMappedMemory(cpu->sp++); return 10; // POP HL
+		case 0xF1: cpu->f = readMappedMemory(cpu->sp++); cpu->a = readMappedMemory(cpu->sp++); return 10; // POP AF
+		case 0xC2: case 0xCA: case 0xD2: case 0xDA: case 0xE2: case 0xEA: case 0xF2: case 0xFA: // JP cc,nn
+			cpu->wz = operand;
+			if (z80OpCondition(cpu, (opcode >> 3) & 7)) {
+				cpu->pc = cpu->wz;
+			}
+			return 10;
+		case 0xC3: cpu->wz = operand; cpu->pc = cpu->wz; return 10; // JP nn
+		case 0xC4: case 0xCC: case 0xD4: case 0xDC: case 0xE4: case 0xEC: case 0xF4: case 0xFC: // CALL cc,nn
+			cpu->wz = operand;
+			if (!z80OpCondition(cpu, (opcode >> 3) & 7)) {
+				return 10;
+			}
+			writeMappedMemory(--cpu->sp, cpu->pch);
+			writeMappedMemory(--cpu->sp, cpu->pcl);
+			cpu->pc = cpu->wz;
+			return 17;
+		case 0xC5: writeMappedMemory(--cpu->sp, cpu->b); writeMappedMemory(--cpu->sp, cpu->c); return 11; // PUSH BC
+		case 0xD5: writeMappedMemory(--cpu->sp, cpu->d); writeMappedMemory(--cpu->sp, cpu->e); return 11; // PUSH DE
+		case 0xE5: writeMappedMemory(--cpu->sp, cpu->h); writeMappedMemory(--cpu->sp, cpu->l); return 11; // PUSH HL
+		case 0xF5: writeMappedMemory(--cpu->sp, cpu->a); writeMappedMemory(--cpu->sp, cpu->f); return 11; // PUSH AF
+		case 0xC6: _z80_add8(cpu, (uint8_t)operand); return 7; // ADD n
+		case 0xCE: _z80_adc8(cpu, (uint8_t)operand); return 7; // ADC n
+		case 0xD6: _z80_sub8(cpu, (uint8_t)operand); return 7; // SUB n
+		case 0xDE: _z80_sbc8(cpu, (uint8_t)operand); return 7; // SBC n
+		case 0xE6: _z80_and8(cpu, (uint8_t)operand); return 7; // AND n
+		case 0xEE: _z80_xor8(cpu, (uint8_t)operand); return 7; // XOR n
+		case 0xF6: _z80_or8(cpu, (uint8_t)operand); return 7; // OR n
+		case 0xFE: _z80_cp8(cpu, (uint8_t)operand); return 7; // CP n
+		case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // RST p
+			writeMappedMemory(--cpu->sp, cpu->pch);
+			writeMappedMemory(--cpu->sp, cpu->pcl);
+			cpu->wz = opcode & 0x38;
+			cpu->pc = cpu->wz;
+			return 11;
+		case 0xC9: // RET
+			cpu->wzl = readMappedMemory(cpu->sp++);
+			cpu->wzh = readMappedMemory(cpu->sp++);
+			cpu->pc = cpu->wz;
+			return 10;
+		case 0xCD: // CALL nn
+			cpu->wz = operand;
+			writeMappedMemory(--cpu->sp, cpu->pch);
+			writeMappedMemory(--cpu->sp, cpu->pcl);
+			cpu->pc = cpu->wz;
+			return 17;
+		case 0xD9: _z80_exx(cpu); return 4; // EXX
+		case 0xE3: // EX (SP),HL
+			cpu->wzl = readMappedMemory(cpu->sp);
+			cpu->wzh = readMappedMemory(cpu->sp + 1);
+			writeMappedMemory(cpu->sp + 1, cpu->h);
+			writeMappedMemory(cpu->sp, cpu->l);
+			cpu->hl = cpu->wz;
+			return 19;
+		case 0xE9: cpu->pc = cpu->hl; return 4; // JP HL
+		case 0xEB: _z80_ex_de_hl(cpu); return 4; // EX DE,HL
+		case 0xF9: cpu->sp = cpu->hl; return 6; // LD SP,HL
+		default:
+			// I/O, HALT, DI/EI and the prefixes
+			return 0;
+	}
+}
+
+#endif // CHIPS_IMPL
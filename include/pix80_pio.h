@@ -0,0 +1,218 @@
+#pragma once
+/*
+ * Pix80 Z80 PIO, parallel I/O
+ *
+ * Two 8-bit ports, A and B, on four ports from the one it's attached
+ * to: +0 A data, +1 B data, +2 A control, +3 B control. Control words
+ * are told apart by their low bits:
+ *
+ *   xxxxxxx0  interrupt vector
+ *   mm..1111  mode: 0 output, 1 input, 2 bidirectional, 3 bit control,
+ *             after mode 3 the next word sets the directions (1 = input)
+ *   eahm0111  interrupt control: e enable, a all monitored bits (AND)
+ *             rather than any (OR), h active high, m a mask follows
+ *             (1 = not monitored)
+ *   e...0011  interrupt enable only
+ *
+ * Nothing on the board drives the pins, the host side does it through
+ * pioInput(), which strobes the data in in modes 1 and 2 and changes
+ * the input pins in mode 3, and pioStrobe(), the peripheral taking an
+ * output byte in modes 0 and 2. Both raise the port's interrupt when
+ * it's enabled, in mode 3 only when the monitored bits start matching.
+ * Both ports are on the interrupt daisy chain, A first.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "pix80_io.h"
+#include "pix80_sched.h"
+#include "pix80_daisy.h"
+
+#define PIO_PORTS 2
+
+#define PIO_OUTPUT 0
+#define PIO_INPUT 1
+#define PIO_BIDIRECTIONAL 2
+#define PIO_BITS 3
+
+#define PIO_INT_ENABLE 0x80
+#define PIO_INT_AND    0x40
+#define PIO_INT_HIGH   0x20
+#define PIO_INT_MASK   0x10
+
+typedef enum {
+	PIO_NEXT_CONTROL,
+	PIO_NEXT_DIRECTION,
+	PIO_NEXT_MASK
+} pioNext_t;
+
+typedef struct {
+	uint8_t mode;
+	uint8_t output;
+	// latched by the strobe in modes 1 and 2
+	uint8_t input;
+	// what the peripheral drives, mode 3 reads these directly
+	uint8_t pins;
+	uint8_t direction;
+	uint8_t mask;
+	uint8_t intControl;
+	pioNext_t next;
+	// mode 3 condition at the last look, it interrupts on becoming true
+	bool matched;
+	daisySource_t irq;
+	uint64_t strobes;
+} pioPort_t;
+
+typedef struct {
+	uint8_t port;
+	pioPort_t ports[PIO_PORTS];
+} pio_t;
+
+extern pio_t pio;
+
+void pioInit();
+// attach the registers to 4 ports from 'port' on, and the ports to the daisy chain
+void attachPIO(uint8_t port);
+// the peripheral puts 'data' on the port's pins and strobes it in
+void pioInput(int port, uint8_t data);
+// the peripheral took the byte that's on an output port
+void pioStrobe(int port);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+
+pio_t pio;
+
+static void pioInterrupt(pioPort_t* port) {
+	if (port->intControl & PIO_INT_ENABLE) {
+		daisyRequest(&port->irq, totalTicks);
+	}
+}
+
+// Mode 3, see if the monitored input bits match and interrupt if they just started to
+static void pioMatch(pioPort_t* port) {
+	if (port->mode != PIO_BITS) {
+		return;
+	}
+	const uint8_t monitored = ~port->mask & port->direction;
+	const uint8_t levels = (port->intControl & PIO_INT_HIGH) ? port->pins : ~port->pins;
+	const uint8_t active = levels & monitored;
+	const bool matched = (port->intControl & PIO_INT_AND) ? monitored && active == monitored : active != 0;
+	if (matched && !port->matched) {
+		pioInterrupt(port);
+	}
+	port->matched = matched;
+}
+
+void pioInput(int index, uint8_t data) {
+	pioPort_t* port = &pio.ports[index];
+	port->pins = data;
+	if (port->mode == PIO_INPUT || port->mode == PIO_BIDIRECTIONAL) {
+		port->input = data;
+		port->strobes++;
+		pioInterrupt(port);
+	} else {
+		pioMatch(port);
+	}
+}
+
+void pioStrobe(int index) {
+	pioPort_t* port = &pio.ports[index];
+	if (port->mode == PIO_OUTPUT || port->mode == PIO_BIDIRECTIONAL) {
+		port->strobes++;
+		pioInterrupt(port);
+	}
+}
+
+static void pioControl(pioPort_t* port, uint8_t data) {
+	switch (port->next) {
+		case PIO_NEXT_DIRECTION:
+			port->direction = data;
+			port->next = PIO_NEXT_CONTROL;
+			pioMatch(port);
+			return;
+		case PIO_NEXT_MASK:
+			port->mask = data;
+			port->next = PIO_NEXT_CONTROL;
+			pioMatch(port);
+			return;
+		default:
+			break;
+	}
+	if (!(data & 1)) {
+		port->irq.vector = data;
+	} else if ((data & 0x0F) == 0x0F) {
+		port->mode = data >> 6;
+		port->matched = false;
+		if (port->mode == PIO_BITS) {
+			port->next = PIO_NEXT_DIRECTION;
+		}
+	} else if ((data & 0x0F) == 0x07) {
+		port->intControl = data & 0xF0;
+		if (data & PIO_INT_MASK) {
+			port->next = PIO_NEXT_MASK;
+		}
+		port->matched = false;
+		pioMatch(port);
+	} else if ((data & 0x0F) == 0x03) {
+		port->intControl = (port->intControl & ~PIO_INT_ENABLE) | (data & PIO_INT_ENABLE);
+	}
+	if (!(port->intControl & PIO_INT_ENABLE)) {
+		daisyWithdraw(&port->irq);
+	}
+}
+
+static uint8_t pioRead(void* context, uint16_t address) {
+	(void)context;
+	const uint8_t offset = (uint8_t)(address - pio.port);
+	const pioPort_t* port = &pio.ports[offset & 1];
+	if (offset >= PIO_PORTS) {
+		// control registers can't be read
+		return 0xFF;
+	}
+	switch (port->mode) {
+		case PIO_OUTPUT: return port->output;
+		case PIO_BITS: return (port->pins & port->direction) | (port->output & ~port->direction);
+		default: return port->input;
+	}
+}
+
+static void pioWrite(void* context, uint16_t address, uint8_t data) {
+	(void)context;
+	const uint8_t offset = (uint8_t)(address - pio.port);
+	pioPort_t* port = &pio.ports[offset & 1];
+	if (offset >= PIO_PORTS) {
+		pioControl(port, data);
+	} else {
+		port->output = data;
+	}
+}
+
+void pioInit() {
+	static const char* names[PIO_PORTS] = { "pioA", "pioB" };
+	for (int i = 0; i < PIO_PORTS; i++) {
+		pioPort_t* port = &pio.ports[i];
+		port->mode = PIO_INPUT;
+		port->output = port->input = 0;
+		port->pins = 0xFF;
+		port->direction = 0xFF;
+		port->mask = 0xFF;
+		port->intControl = 0;
+		port->next = PIO_NEXT_CONTROL;
+		port->matched = false;
+		port->strobes = 0;
+		daisyInit(&port->irq, names[i]);
+	}
+}
+
+void attachPIO(uint8_t port) {
+	pio.port = port;
+	ioRegisterRange(port, PIO_PORTS * 2, "pio", pioRead, pioWrite, &pio);
+	for (int i = 0; i < PIO_PORTS; i++) {
+		daisyAttach(&pio.ports[i].irq);
+	}
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,284 @@
+#pragma once
+/*
+ * Pix80 guest profiler
+ *
+ * Where the firmware spends its cycles. Every instruction boundary
+ * adds the cycles and instructions since the last one to the entry of
+ * the instruction that started there, so an update is one add to each
+ * of two counters. Entries are a flat array indexed by address: the
+ * fixed ROM and RAM by the address alone, the Banking Area by bank and
+ * address, so code in different banks at the same address is kept
+ * apart. Time spent halted goes to the HALT, an interrupt's acknowledge
+ * to the instruction it came after.
+ *
+ * profileReport() writes the entries that ran, hottest first. With a
+ * pasmo symbol file (pasmo <source> <binary> <symbols>, lines like
+ * "label EQU 0ABCDH") every address also counts towards the closest
+ * label at or below it, listed in a section of its own. pasmo doesn't
+ * tell labels from other EQUs, so a constant that looks like an
+ * address in the code can claim some of it.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "pix80_memory.h"
+
+// the fixed area, then MEM_MAX_BANKS banks
+#define PROFILE_ENTRIES (0x10000 + MEM_MAX_BANKS * MEM_BANK_SIZE)
+
+typedef struct {
+	uint64_t cycles;
+	uint64_t instructions;
+} profileEntry_t;
+
+typedef struct {
+	uint16_t address;
+	char name[64];
+	uint64_t cycles;
+	uint64_t instructions;
+} profileSymbol_t;
+
+extern profileEntry_t* profileEntries;
+// the instruction that started at the last boundary, and the totals then
+extern uint32_t profileLast;
+extern uint64_t profileLastTicks;
+extern uint64_t profileLastInstructions;
+
+// start profiling at 'ticks' and 'instructions' into the run
+bool profileInit(uint64_t ticks, uint64_t instructions);
+// write the report, 'symbolPath' may be NULL
+bool profileReport(const char* path, const char* symbolPath);
+// read a pasmo symbol file, sorted by address, NULL if it can't be read
+profileSymbol_t* profileLoadSymbols(const char* path, int* count);
+// the closest symbol at or below 'address', NULL if there's none
+profileSymbol_t* profileSymbolAt(profileSymbol_t* symbols, int count, uint16_t address);
+
+static inline uint32_t profileIndex(uint16_t address, uint8_t bank) {
+	if (address >= MEM_BANK_START && address < MEM_RAM_START) {
+		return 0x10000 + (uint32_t)bank * MEM_BANK_SIZE + (address - MEM_BANK_START);
+	}
+	return address;
+}
+
+// An instruction boundary, the next instruction starts at 'pc' in 'bank'
+static inline void profileInstruction(uint16_t pc, uint8_t bank, uint64_t ticks, uint64_t instructions) {
+	profileEntry_t* entry = &profileEntries[profileLast];
+	entry->cycles += ticks - profileLastTicks;
+	entry->instructions += instructions - profileLastInstructions;
+	profileLast = profileIndex(pc, bank);
+	profileLastTicks = ticks;
+	profileLastInstructions = instructions;
+}
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+
+profileEntry_t* profileEntries = NULL;
+uint32_t profileLast = 0;
+uint64_t profileLastTicks = 0;
+uint64_t profileLastInstructions = 0;
+
+bool profileInit(uint64_t ticks, uint64_t instructions) {
+	// mostly never touched, the pages only get memory once they are
+	void* entries = mmap(NULL, PROFILE_ENTRIES * sizeof(profileEntry_t), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (entries == MAP_FAILED) {
+		return false;
+	}
+	profileEntries = (profileEntry_t*)entries;
+	profileLast = 0;
+	profileLastTicks = ticks;
+	profileLastInstructions = instructions;
+	return true;
+}
+
+typedef struct {
+	uint32_t index;
+	uint64_t cycles;
+	uint64_t instructions;
+} profileHot_t;
+
+static int profileCompareAddresses(const void* a, const void* b) {
+	return (int)((const profileSymbol_t*)a)->address - (int)((const profileSymbol_t*)b)->address;
+}
+
+// Hottest first, ties in address order
+static int profileCompareSymbolCycles(const void* a, const void* b) {
+	const uint64_t x = ((const profileSymbol_t*)a)->cycles, y = ((const profileSymbol_t*)b)->cycles;
+	return x < y ? 1 : (x > y ? -1 : profileCompareAddresses(a, b));
+}
+
+static int profileCompareHotCycles(const void* a, const void* b) {
+	const profileHot_t* x = (const profileHot_t*)a;
+	const profileHot_t* y = (const profileHot_t*)b;
+	if (x->cycles != y->cycles) {
+		return x->cycles < y->cycles ? 1 : -1;
+	}
+	return x->index < y->index ? -1 : (x->index > y->index ? 1 : 0);
+}
+
+// Read "label EQU value" lines, values as pasmo writes them (0ABCDH) or 0x, $ or decimal
+profileSymbol_t* profileLoadSymbols(const char* path, int* count) {
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		return NULL;
+	}
+	int capacity = 256;
+	profileSymbol_t* symbols = (profileSymbol_t*)malloc(capacity * sizeof(profileSymbol_t));
+	*count = 0;
+	char line[256];
+	while (symbols && fgets(line, sizeof(line), file)) {
+		char name[64], equ[8], value[32];
+		if (sscanf(line, "%63s %7s %31s", name, equ, value) != 3 || strcasecmp(equ, "EQU") != 0) {
+			continue;
+		}
+		const size_t length = strlen(value);
+		char* end;
+		unsigned long address;
+		if (value[length - 1] == 'H' || value[length - 1] == 'h') {
+			value[length - 1] = '\0';
+			address = strtoul(value, &end, 16);
+		} else if (value[0] == '$' || value[0] == '#') {
+			address = strtoul(value + 1, &end, 16);
+		} else {
+			address = strtoul(value, &end, 0);
+		}
+		if (*end != '\0' || address > 0xFFFF) {
+			continue;
+		}
+		if (*count == capacity) {
+			capacity *= 2;
+			symbols = (profileSymbol_t*)realloc(symbols, capacity * sizeof(profileSymbol_t));
+			if (!symbols) {
+				break;
+			}
+		}
+		profileSymbol_t* symbol = &symbols[(*count)++];
+		symbol->address = (uint16_t)address;
+		strcpy(symbol->name, name);
+		symbol->cycles = symbol->instructions = 0;
+	}
+	fclose(file);
+	if (symbols) {
+		qsort(symbols, *count, sizeof(profileSymbol_t), profileCompareAddresses);
+	}
+	return symbols;
+}
+
+profileSymbol_t* profileSymbolAt(profileSymbol_t* symbols, int count, uint16_t address) {
+	int low = 0, high = count;
+	while (low < high) {
+		const int middle = (low + high) / 2;
+		if (symbols[middle].address <= address) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low ? &symbols[low - 1] : NULL;
+}
+
+bool profileReport(const char* path, const char* symbolPath) {
+	int symbolCount = 0;
+	profileSymbol_t* symbols = NULL;
+	if (symbolPath) {
+		symbols = profileLoadSymbols(symbolPath, &symbolCount);
+		if (!symbols) {
+			return false;
+		}
+	}
+	FILE* out = fopen(path, "w");
+	if (!out) {
+		free(symbols);
+		return false;
+	}
+	// the entries that ran
+	size_t hotCount = 0, hotCapacity = 4096;
+	profileHot_t* hot = (profileHot_t*)malloc(hotCapacity * sizeof(profileHot_t));
+	uint64_t totalCycles = 0, totalInstructions = 0;
+	for (uint32_t i = 0; hot && i < PROFILE_ENTRIES; i++) {
+		const profileEntry_t* entry = &profileEntries[i];
+		if (!entry->cycles && !entry->instructions) {
+			continue;
+		}
+		if (hotCount == hotCapacity) {
+			hotCapacity *= 2;
+			hot = (profileHot_t*)realloc(hot, hotCapacity * sizeof(profileHot_t));
+			if (!hot) {
+				break;
+			}
+		}
+		hot[hotCount].index = i;
+		hot[hotCount].cycles = entry->cycles;
+		hot[hotCount].instructions = entry->instructions;
+		hotCount++;
+		totalCycles += entry->cycles;
+		totalInstructions += entry->instructions;
+	}
+	if (!hot) {
+		fclose(out);
+		free(symbols);
+		return false;
+	}
+	qsort(hot, hotCount, sizeof(profileHot_t), profileCompareHotCycles);
+	const double percent = totalCycles ? 100.0 / totalCycles : 0.0;
+	fprintf(out, "Profile: %llu cycles, %llu instructions\n",
+		(unsigned long long)totalCycles, (unsigned long long)totalInstructions);
+	if (symbols) {
+		profileSymbol_t none = { 0, "(no label)", 0, 0 };
+		for (size_t i = 0; i < hotCount; i++) {
+			const uint16_t address = hot[i].index < 0x10000 ? (uint16_t)hot[i].index :
+				(uint16_t)(MEM_BANK_START + (hot[i].index - 0x10000) % MEM_BANK_SIZE);
+			profileSymbol_t* symbol = profileSymbolAt(symbols, symbolCount, address);
+			symbol = symbol ? symbol : &none;
+			symbol->cycles += hot[i].cycles;
+			symbol->instructions += hot[i].instructions;
+		}
+		qsort(symbols, symbolCount, sizeof(profileSymbol_t), profileCompareSymbolCycles);
+		fprintf(out, "\nBy label:\n%14s %7s %14s  %s\n", "cycles", "%", "instructions", "label");
+		for (int i = 0; i < symbolCount + 1; i++) {
+			const profileSymbol_t* symbol = i < symbolCount ? &symbols[i] : &none;
+			if (symbol->cycles || symbol->instructions) {
+				fprintf(out, "%14llu %6.2f%% %14llu  %s\n", (unsigned long long)symbol->cycles,
+					symbol->cycles * percent, (unsigned long long)symbol->instructions, symbol->name);
+			}
+		}
+		// back in address order for the lookups below
+		qsort(symbols, symbolCount, sizeof(profileSymbol_t), profileCompareAddresses);
+	}
+	fprintf(out, "\nBy address:\n%14s %7s %14s  %-7s  %s\n", "cycles", "%", "instructions", "address", symbols ? "label" : "");
+	for (size_t i = 0; i < hotCount; i++) {
+		char where[16], label[96] = "";
+		uint16_t address;
+		if (hot[i].index < 0x10000) {
+			address = (uint16_t)hot[i].index;
+			snprintf(where, sizeof(where), "   %04X", address);
+		} else {
+			const uint32_t offset = hot[i].index - 0x10000;
+			address = (uint16_t)(MEM_BANK_START + offset % MEM_BANK_SIZE);
+			snprintf(where, sizeof(where), "%02X:%04X", offset / MEM_BANK_SIZE, address);
+		}
+		const profileSymbol_t* symbol = symbols ? profileSymbolAt(symbols, symbolCount, address) : NULL;
+		if (symbol && address == symbol->address) {
+			snprintf(label, sizeof(label), "%s", symbol->name);
+		} else if (symbol) {
+			snprintf(label, sizeof(label), "%s+%u", symbol->name, (unsigned)(address - symbol->address));
+		}
+		fprintf(out, "%14llu %6.2f%% %14llu  %s  %s\n", (unsigned long long)hot[i].cycles,
+			hot[i].cycles * percent, (unsigned long long)hot[i].instructions, where, label);
+	}
+	const bool ok = ferror(out) == 0;
+	fclose(out);
+	free(hot);
+	free(symbols);
+	return ok;
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,278 @@
+#pragma once
+/*
+ * Pix80 ahead-of-time ROM recompiler
+ *
+ * The fixed ROM never changes while the machine runs, so its code can
+ * be translated once, ahead of time, into C that the host compiler
+ * optimises like any other code. recompileROM() follows the control
+ * flow from a set of entry points (reset, the RST 38h interrupt
+ * handler, ...), splits the code it reaches into basic blocks and
+ * writes one C function per block, built from the instructions of
+ * pix80_ops.h.
+ *
+ * The generated file is compiled into the emulator by passing it to
+ * compile.sh, which defines PIX80_AOT. It records a hash of the ROM
+ * it was made from and is only used when the loaded ROM matches.
+ * Anything it doesn't cover (code that's only reached through JP (HL)
+ * or RET, the banks and RAM, I/O, prefixed instructions) runs on the
+ * cycle-stepped core as usual.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "z80.h"
+#include "pix80_memory.h"
+#include "pix80_ops.h"
+
+#define AOT_MAX_INSTRUCTIONS 64
+
+typedef struct {
+	uint16_t pc;
+	z80BlockResult_t (*run)(z80_t* cpu);
+	// cycles if the final branch is taken
+	uint32_t maxCycles;
+} aotBlock_t;
+
+// hash of the fixed ROM as the generated code sees it
+uint32_t aotROMHash();
+// translate the ROM code reachable from 'entries' into C
+bool recompileROM(const char* path, const uint16_t* entries, int count, const char* source);
+// use the compiled-in blocks, false if there are none or they're for another ROM
+bool aotInit();
+// run the block at 'pc' if there is one that takes no more than 'budget' cycles
+bool aotRun(z80_t* cpu, uint16_t pc, uint64_t budget, z80BlockResult_t* result);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <stdio.h>
+#include <string.h>
+
+#ifdef PIX80_AOT
+#include PIX80_AOT
+#else
+static const uint32_t aotBlocksROMHash = 0;
+static const aotBlock_t aotBlocks[] = { { 0, NULL, 0 } };
+static const int aotBlockCount = 0;
+#endif
+
+static const aotBlock_t* aotBlockAt[MEM_BANK_SIZE];
+
+uint32_t aotROMHash() {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < MEM_BANK_SIZE; i++) {
+		hash = (hash ^ onBoardROM[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// Length of the instruction at 'pc', prefixes included
+static int aotInstructionLength(uint16_t pc) {
+	const uint8_t opcode = onBoardROM[pc];
+	if (opcode == 0xCB) {
+		return 2;
+	}
+	if (opcode == 0xED) {
+		// LD (nn),rr and LD rr,(nn)
+		return ((onBoardROM[(pc + 1) & 0x3FFF] & 0xC7) == 0x43) ? 4 : 2;
+	}
+	if (opcode == 0xDD || opcode == 0xFD) {
+		const uint8_t next = onBoardROM[(pc + 1) & 0x3FFF];
+		if (next == 0xCB) {
+			return 4;
+		}
+		if (next == 0xDD || next == 0xED || next == 0xFD) {
+			// the prefix only acts as a NOP
+			return 1;
+		}
+		// the (HL) forms turn into (IX+d) and take a displacement byte
+		const bool indexed = (next == 0x34 || next == 0x35 || next == 0x36) ||
+			((next & 0xC0) == 0x40 && ((next & 7) == 6 || (next & 0x38) == 0x30) && next != 0x76) ||
+			((next & 0xC7) == 0x86);
+		return 1 + (z80OpInfo[next] & Z80_OP_LENGTH) + (indexed ? 1 : 0);
+	}
+	return z80OpInfo[opcode] & Z80_OP_LENGTH;
+}
+
+typedef struct {
+	bool instruction[MEM_BANK_SIZE];
+	bool leader[MEM_BANK_SIZE];
+	uint16_t work[MEM_BANK_SIZE];
+	int pending;
+} aotFlow_t;
+
+static void aotBranchTo(aotFlow_t* flow, uint32_t target) {
+	if (target >= MEM_BANK_SIZE) {
+		// leaves the fixed ROM, not ours to follow
+		return;
+	}
+	flow->leader[target] = true;
+	if (!flow->instruction[target]) {
+		flow->work[flow->pending++] = (uint16_t)target;
+		// only queue it once
+		flow->instruction[target] = true;
+	}
+}
+
+// Follow the code from each entry point until it ends in an unconditional jump
+static void aotTrace(aotFlow_t* flow, const uint16_t* entries, int count) {
+	memset(flow, 0, sizeof(*flow));
+	for (int i = 0; i < count; i++) {
+		aotBranchTo(flow, entries[i]);
+	}
+	while (flow->pending) {
+		uint32_t pc = flow->work[--flow->pending];
+		for (;;) {
+			flow->instruction[pc] = true;
+			const uint8_t opcode = onBoardROM[pc];
+			const int length = aotInstructionLength((uint16_t)pc);
+			const uint32_t next = pc + length;
+			const uint16_t operand = onBoardROM[(pc + 1) & 0x3FFF] | (onBoardROM[(pc + 2) & 0x3FFF] << 8);
+			if (next > MEM_BANK_SIZE) {
+				break;
+			}
+			bool ends = false;
+			if (!(z80OpInfo[opcode] & Z80_OP_ATOMIC)) {
+				// left to the cycle-stepped core, a new block starts after it
+				const uint8_t second = onBoardROM[(pc + 1) & 0x3FFF];
+				// RETN/RETI and JP (IX)/JP (IY) go nowhere we can see
+				ends = (opcode == 0xED && (second & 0xC7) == 0x45) || ((opcode == 0xDD || opcode == 0xFD) && second == 0xE9);
+				if (!ends) {
+					aotBranchTo(flow, next);
+				}
+			} else if (z80OpInfo[opcode] & Z80_OP_BRANCH) {
+				const uint8_t z = opcode & 7;
+				if (opcode == 0x10 || opcode == 0x18 || (opcode & 0xE7) == 0x20) {
+					// DJNZ, JR, JR cc
+					aotBranchTo(flow, (uint16_t)(next + (int8_t)operand));
+				} else if (opcode == 0xC3 || opcode == 0xCD || z == 2 || z == 4) {
+					// JP, CALL and their conditional forms
+					aotBranchTo(flow, operand);
+				} else if (z == 7) {
+					// RST
+					aotBranchTo(flow, opcode & 0x38);
+				}
+				// JP, JR, RET and JP (HL) never fall through, everything else can
+				ends = opcode == 0xC3 || opcode == 0x18 || opcode == 0xC9 || opcode == 0xE9;
+				if (!ends) {
+					aotBranchTo(flow, next);
+				}
+			}
+			if (ends || next == MEM_BANK_SIZE || flow->leader[next]) {
+				break;
+			}
+			pc = next;
+		}
+	}
+}
+
+// One C function per basic block that starts with something pix80_ops.h covers
+static int aotWriteBlock(FILE* out, const aotFlow_t* flow, uint16_t start, uint32_t* maxCycles) {
+	uint32_t pc = start;
+	uint32_t cycles = 0;
+	int count = 0;
+	bool branched = false;
+	fprintf(out, "static z80BlockResult_t aotBlock%04X(z80_t* cpu) {\n", start);
+	while (count < AOT_MAX_INSTRUCTIONS && pc < MEM_BANK_SIZE && (count == 0 || !flow->leader[pc])) {
+		const uint8_t opcode = onBoardROM[pc];
+		const uint32_t length = z80OpInfo[opcode] & Z80_OP_LENGTH;
+		if (!(z80OpInfo[opcode] & Z80_OP_ATOMIC) || pc + length > MEM_BANK_SIZE) {
+			break;
+		}
+		const uint16_t operand = onBoardROM[(pc + 1) & 0x3FFF] | (onBoardROM[(pc + 2) & 0x3FFF] << 8);
+		char bytes[16];
+		int used = 0;
+		for (uint32_t i = 0; i < length; i++) {
+			used += snprintf(bytes + used, sizeof(bytes) - used, " %02X", onBoardROM[pc + i]);
+		}
+		count++;
+		if (z80OpInfo[opcode] & Z80_OP_BRANCH) {
+			fprintf(out, "\tcpu->pc = 0x%04X;\n", pc + length);
+			fprintf(out, "\tconst z80BlockResult_t result = { %u + z80OpExecute(cpu, 0x%02X, 0x%04X), %d }; // %04X:%s\n",
+				cycles, opcode, operand, count, pc, bytes);
+			cycles += z80OpCycles[opcode];
+			branched = true;
+			break;
+		}
+		fprintf(out, "\tz80OpExecute(cpu, 0x%02X, 0x%04X); // %04X:%s\n", opcode, operand, pc, bytes);
+		cycles += z80OpCycles[opcode];
+		pc += length;
+	}
+	if (!branched) {
+		fprintf(out, "\tcpu->pc = 0x%04X;\n", pc);
+		fprintf(out, "\tconst z80BlockResult_t result = { %u, %d };\n", cycles, count);
+	}
+	fprintf(out, "\treturn result;\n}\n\n");
+	*maxCycles = cycles;
+	return count;
+}
+
+bool recompileROM(const char* path, const uint16_t* entries, int count, const char* source) {
+	static aotFlow_t flow;
+	aotTrace(&flow, entries, count);
+	FILE* out = fopen(path, "w");
+	if (!out) {
+		return false;
+	}
+	fprintf(out, "// Generated by pix80emu --recompile from %s, don't edit.\n", source);
+	fprintf(out, "// Build with ./compile.sh %s\n\n", path);
+	fprintf(out, "static const uint32_t aotBlocksROMHash = 0x%08X;\n\n", aotROMHash());
+
+	static uint32_t maxCycles[MEM_BANK_SIZE];
+	int blocks = 0;
+	for (int pc = 0; pc < MEM_BANK_SIZE; pc++) {
+		if (flow.leader[pc] && (z80OpInfo[onBoardROM[pc]] & Z80_OP_ATOMIC)) {
+			aotWriteBlock(out, &flow, (uint16_t)pc, &maxCycles[pc]);
+			blocks++;
+		}
+	}
+	fprintf(out, "static const aotBlock_t aotBlocks[] = {\n");
+	for (int pc = 0; pc < MEM_BANK_SIZE; pc++) {
+		if (flow.leader[pc] && (z80OpInfo[onBoardROM[pc]] & Z80_OP_ATOMIC)) {
+			fprintf(out, "\t{ 0x%04X, aotBlock%04X, %u },\n", pc, pc, maxCycles[pc]);
+		}
+	}
+	if (blocks == 0) {
+		fprintf(out, "\t{ 0, NULL, 0 },\n");
+	}
+	fprintf(out, "};\n");
+	fprintf(out, "static const int aotBlockCount = %d;\n", blocks);
+	const bool ok = ferror(out) == 0;
+	fclose(out);
+	fprintf(stderr, "Recompiled %d blocks into %s\n", blocks, path);
+	return ok;
+}
+
+bool aotInit() {
+	if (aotBlockCount == 0) {
+		fprintf(stderr, "No recompiled code built in, rebuild with ./compile.sh <file>\n");
+		return false;
+	}
+	if (aotROMHash() != aotBlocksROMHash) {
+		fprintf(stderr, "The recompiled code was made for a different ROM, not using it\n");
+		return false;
+	}
+	for (int i = 0; i < aotBlockCount; i++) {
+		aotBlockAt[aotBlocks[i].pc] = &aotBlocks[i];
+	}
+	return true;
+}
+
+bool aotRun(z80_t* cpu, uint16_t pc, uint64_t budget, z80BlockResult_t* result) {
+	if (pc >= MEM_BANK_SIZE) {
+		return false;
+	}
+	const aotBlock_t* block = aotBlockAt[pc];
+	if (!block || block->maxCycles > budget) {
+		return false;
+	}
+	cpu->pc = pc;
+	*result = block->run(cpu);
+	// one refresh cycle per opcode fetch
+	cpu->r = (cpu->r & 0x80) | ((cpu->r + result->instructions) & 0x7F);
+	return true;
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,168 @@
+#pragma once
+/*
+ * Pix80 event scheduler
+ *
+ * Devices that need to act at a certain time post an event for that
+ * cycle instead of being polled from the tick loop. main() asks for
+ * the next due cycle, runs the CPU up to it and then has schedRunDue()
+ * call everything that's due, in cycle order. It asks again after
+ * every step, an event posted while the CPU talks to a device can be
+ * due before the one it was heading for. The CPU stops on the tick an
+ * event is due, in the middle of an instruction if need be, so a line
+ * the event raises is seen just as early as when ticking one cycle at
+ * a time. The callback gets the cycle it was scheduled for, so
+ * periodic events don't drift when the CPU gets there late, as it can
+ * while it's halted.
+ *
+ * An event is a struct the device owns, usually part of its state,
+ * the scheduler only keeps a pointer to it in a binary heap. Posting
+ * an event that's already pending moves it, cancelling one that
+ * isn't pending does nothing, both are O(log n).
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHED_MAX_EVENTS 64
+#define SCHED_NEVER UINT64_MAX
+
+typedef struct schedEvent_t schedEvent_t;
+typedef void (*schedFn)(void* context, uint64_t cycle);
+
+struct schedEvent_t {
+	schedFn fn;
+	void* context;
+	const char* name;
+	uint64_t cycle;
+	// ties go first come, first served
+	uint64_t order;
+	// position in the heap, -1 while not pending
+	int slot;
+};
+
+typedef struct {
+	schedEvent_t* heap[SCHED_MAX_EVENTS];
+	int count;
+	uint64_t posted;
+	uint64_t fired;
+} scheduler_t;
+
+extern scheduler_t scheduler;
+// The machine's cycle counter. The cycle-stepped core advances it
+// every tick, the fast core only up to the instruction doing I/O.
+extern uint64_t totalTicks;
+
+// set up an event, it starts out not pending
+void schedInit(schedEvent_t* event, const char* name, schedFn fn, void* context);
+// (re)schedule an event for 'cycle', false if there's no room left
+bool schedAt(schedEvent_t* event, uint64_t cycle);
+void schedCancel(schedEvent_t* event);
+// fire every event that's due at 'cycle', including ones they post
+void schedRunDue(uint64_t cycle);
+
+static inline bool schedPending(const schedEvent_t* event) {
+	return event->slot >= 0;
+}
+
+// cycle of the earliest pending event, SCHED_NEVER if there's none
+static inline uint64_t schedNext() {
+	return scheduler.count ? scheduler.heap[0]->cycle : SCHED_NEVER;
+}
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+
+scheduler_t scheduler;
+uint64_t totalTicks = 0;
+
+static inline bool schedBefore(const schedEvent_t* a, const schedEvent_t* b) {
+	return a->cycle < b->cycle || (a->cycle == b->cycle && a->order < b->order);
+}
+
+static inline void schedPlace(schedEvent_t* event, int slot) {
+	scheduler.heap[slot] = event;
+	event->slot = slot;
+}
+
+static void schedSiftUp(int slot) {
+	schedEvent_t* event = scheduler.heap[slot];
+	while (slot > 0) {
+		const int parent = (slot - 1) / 2;
+		if (!schedBefore(event, scheduler.heap[parent])) {
+			break;
+		}
+		schedPlace(scheduler.heap[parent], slot);
+		slot = parent;
+	}
+	schedPlace(event, slot);
+}
+
+static void schedSiftDown(int slot) {
+	schedEvent_t* event = scheduler.heap[slot];
+	for (;;) {
+		int child = slot * 2 + 1;
+		if (child >= scheduler.count) {
+			break;
+		}
+		if (child + 1 < scheduler.count && schedBefore(scheduler.heap[child + 1], scheduler.heap[child])) {
+			child++;
+		}
+		if (!schedBefore(scheduler.heap[child], event)) {
+			break;
+		}
+		schedPlace(scheduler.heap[child], slot);
+		slot = child;
+	}
+	schedPlace(event, slot);
+}
+
+void schedInit(schedEvent_t* event, const char* name, schedFn fn, void* context) {
+	event->fn = fn;
+	event->context = context;
+	event->name = name;
+	event->cycle = SCHED_NEVER;
+	event->order = 0;
+	event->slot = -1;
+}
+
+bool schedAt(schedEvent_t* event, uint64_t cycle) {
+	if (schedPending(event)) {
+		schedCancel(event);
+	} else if (scheduler.count == SCHED_MAX_EVENTS) {
+		return false;
+	}
+	event->cycle = cycle;
+	event->order = scheduler.posted++;
+	scheduler.heap[scheduler.count] = event;
+	schedSiftUp(scheduler.count++);
+	return true;
+}
+
+void schedCancel(schedEvent_t* event) {
+	if (!schedPending(event)) {
+		return;
+	}
+	const int slot = event->slot;
+	schedEvent_t* last = scheduler.heap[--scheduler.count];
+	event->slot = -1;
+	if (last != event) {
+		// the last one fills the hole and moves to where it belongs
+		schedPlace(last, slot);
+		schedSiftDown(slot);
+		schedSiftUp(last->slot);
+	}
+}
+
+void schedRunDue(uint64_t cycle) {
+	while (scheduler.count && scheduler.heap[0]->cycle <= cycle) {
+		schedEvent_t* event = scheduler.heap[0];
+		schedCancel(event);
+		scheduler.fired++;
+		// may post itself or others again
+		event->fn(event->context, event->cycle);
+	}
+}
+
+#endif // CHIPS_IMPL
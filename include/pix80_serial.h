@@ -0,0 +1,145 @@
+#pragma once
+/*
+ * Pix80 serial port output
+ *
+ * Bytes written to the serial port are collected in a large buffer
+ * instead of going out one putchar() at a time. The buffer is
+ * flushed when it's full, on a newline if line flushing is on, once
+ * the oldest byte in it has waited 'flush interval' cycles and at
+ * exit. The wait is an event on the scheduler, posted when a byte
+ * goes into the empty buffer.
+ *
+ * By default the buffer goes out through stdout's stdio stream, the
+ * same one the debug output uses. Given a file descriptor, it's
+ * written there directly with write() instead. A sink, when there is
+ * one, gets every flush too and takes stdout's place.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "pix80_io.h"
+#include "pix80_sched.h"
+
+#define SERIAL_BUFFER_SIZE (1 << 16)
+
+typedef struct {
+	uint8_t buffer[SERIAL_BUFFER_SIZE];
+	uint32_t length;
+	// fd to write() to, -1 for stdout
+	int fd;
+	// gets everything flushed, stdout isn't written when set
+	void (*sink)(const uint8_t* data, uint32_t length);
+	bool lineFlush;
+	uint64_t flushInterval;
+	// flushes the buffer once its oldest byte has waited long enough
+	schedEvent_t flushEvent;
+	uint64_t bytesWritten;
+	uint64_t flushes;
+} serial_t;
+
+extern serial_t serial;
+
+// fd < 0 writes through stdout, line flushing defaults to on for terminals
+void serialInit(int fd, uint64_t flushInterval);
+// attach the serial port's output to an I/O port
+void attachSerial(uint8_t port);
+void serialFlush();
+// write() out the buffer and nothing else, for a crash handler
+void serialFlushRaw();
+
+static inline void serialWrite(uint8_t data) {
+	if (serial.length == 0 && serial.flushInterval) {
+		schedAt(&serial.flushEvent, totalTicks + serial.flushInterval);
+	}
+	serial.buffer[serial.length++] = data;
+	if (serial.length == SERIAL_BUFFER_SIZE || (serial.lineFlush && data == '\n')) {
+		serialFlush();
+	}
+}
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
+serial_t serial;
+
+static void serialFlushDue(void* context, uint64_t cycle) {
+	(void)context;
+	(void)cycle;
+	serialFlush();
+}
+
+void serialInit(int fd, uint64_t flushInterval) {
+	serial.length = 0;
+	serial.fd = fd;
+	serial.sink = NULL;
+	serial.flushInterval = flushInterval;
+	serial.lineFlush = isatty(fd < 0 ? STDOUT_FILENO : fd);
+	serial.bytesWritten = serial.flushes = 0;
+	schedInit(&serial.flushEvent, "serial flush", serialFlushDue, NULL);
+}
+
+static void serialPortWrite(void* context, uint16_t port, uint8_t data) {
+	(void)context;
+	(void)port;
+	serialWrite(data);
+}
+
+void attachSerial(uint8_t port) {
+	ioRegister(port, "serial", NULL, serialPortWrite, &serial);
+}
+
+void serialFlush() {
+	schedCancel(&serial.flushEvent);
+	if (serial.length == 0) {
+		return;
+	}
+	if (serial.sink) {
+		serial.sink(serial.buffer, serial.length);
+	}
+	if (serial.fd < 0) {
+		if (!serial.sink) {
+			fwrite(serial.buffer, 1, serial.length, stdout);
+			fflush(stdout);
+		}
+	} else {
+		for (uint32_t done = 0; done < serial.length;) {
+			ssize_t written = write(serial.fd, serial.buffer + done, serial.length - done);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				break;
+			}
+			done += (uint32_t)written;
+		}
+	}
+	serial.bytesWritten += serial.length;
+	serial.flushes++;
+	serial.length = 0;
+}
+
+// stdout's own buffer is left alone, serialFlush() leaves it empty anyway
+void serialFlushRaw() {
+	const int fd = serial.fd < 0 ? STDOUT_FILENO : serial.fd;
+	if (serial.sink) {
+		return;
+	}
+	for (uint32_t done = 0; done < serial.length;) {
+		ssize_t written = write(fd, serial.buffer + done, serial.length - done);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		done += (uint32_t)written;
+	}
+	serial.length = 0;
+}
+
+#endif // CHIPS_IMPL
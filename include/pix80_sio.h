@@ -0,0 +1,331 @@
+#pragma once
+/*
+ * Pix80 Z80 SIO, serial I/O
+ *
+ * Two asynchronous channels, A and B, on four ports from the one it's
+ * attached to: +0 A data, +1 B data, +2 A control, +3 B control. A
+ * control write goes to the write register WR0 points at, which then
+ * points back at WR0. The parts that matter here:
+ *
+ *   WR0  bits 0-2 register pointer, bits 3-5 command: 3 channel reset,
+ *        4 interrupt on the next received character, 5 drop the
+ *        transmit interrupt, 7 return from interrupt (channel A)
+ *   WR1  bit 1 transmit interrupt, bit 2 status affects vector (B),
+ *        bits 3-4 receive interrupt: off, first character, all
+ *   WR2  interrupt vector (B)
+ *   WR3  bit 0 receiver enable
+ *   WR4  bits 6-7 clock divider 1/16/32/64, bits 2-3 stop bits, bit 0 parity
+ *   WR5  bit 3 transmitter enable, bits 5-6 bits per character
+ *
+ * and RR0 (bit 0 character received, bit 2 transmit buffer empty, CTS
+ * and DCD always high), RR1 (bit 0 all sent) and RR2 (B, the vector).
+ *
+ * A character takes its start, data, parity and stop bits times the
+ * divider times 'clockCycles' CPU cycles on the line, which is when the
+ * transmitter or receiver event for it fires, there's no work in
+ * between. Sent bytes go to the channel's output callback, received
+ * ones come from a buffer given to sioFeed(). There are no modem lines
+ * so no external/status interrupts. Receive and transmit of A, then of
+ * B, are on the interrupt daisy chain in that order.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "pix80_io.h"
+#include "pix80_sched.h"
+#include "pix80_daisy.h"
+
+#define SIO_CHANNELS 2
+
+typedef void (*sioOutputFn)(uint8_t data);
+
+typedef struct {
+	uint8_t wr[8];
+	uint8_t pointer;
+	// receiver
+	uint8_t rxData;
+	bool rxAvailable;
+	// interrupt on first character armed
+	bool rxFirst;
+	const uint8_t* input;
+	size_t inputLength;
+	size_t inputPos;
+	schedEvent_t rxEvent;
+	// transmitter, a one byte buffer in front of the shift register
+	uint8_t txBuffer;
+	bool txFull;
+	uint8_t txShift;
+	bool txShifting;
+	schedEvent_t txEvent;
+	sioOutputFn output;
+	daisySource_t rxIrq;
+	daisySource_t txIrq;
+	uint64_t sent;
+	uint64_t received;
+	uint64_t overruns;
+} sioChannel_t;
+
+typedef struct {
+	uint8_t port;
+	// CPU cycles per TxC/RxC clock
+	uint32_t clockCycles;
+	sioChannel_t channels[SIO_CHANNELS];
+} sio_t;
+
+extern sio_t sio;
+
+void sioInit(uint32_t clockCycles);
+// attach the registers to 4 ports from 'port' on, and the channels to the daisy chain
+void attachSIO(uint8_t port);
+// bytes that arrive on the channel's receive line, one per character time
+void sioFeed(int channel, const uint8_t* data, size_t length);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+
+sio_t sio;
+
+// Cycles one character takes on the line
+static uint64_t sioCharCycles(const sioChannel_t* channel) {
+	static const uint8_t dataBits[4] = { 5, 7, 6, 8 };
+	static const uint8_t dividers[4] = { 1, 16, 32, 64 };
+	// in half bits, for 1.5 stop bits
+	const uint8_t stop = (channel->wr[4] >> 2) & 3;
+	const uint32_t halfBits = 2 * (1 + dataBits[(channel->wr[5] >> 5) & 3] + (channel->wr[4] & 1)) + (stop ? stop + 1 : 2);
+	return (uint64_t)halfBits * dividers[channel->wr[4] >> 6] * sio.clockCycles / 2;
+}
+
+static void sioUpdateVectors() {
+	const uint8_t vector = sio.channels[1].wr[2];
+	// status affects vector puts the condition into bits 1-3
+	const bool status = (sio.channels[1].wr[1] & 0x04) != 0;
+	for (int i = 0; i < SIO_CHANNELS; i++) {
+		const uint8_t channel = (i == 0) ? 0x08 : 0;
+		sio.channels[i].rxIrq.vector = status ? (vector & 0xF1) | channel | 0x04 : vector;
+		sio.channels[i].txIrq.vector = status ? (vector & 0xF1) | channel : vector;
+	}
+}
+
+static void sioStartTx(sioChannel_t* channel) {
+	if (channel->txShifting || !channel->txFull || !(channel->wr[5] & 0x08)) {
+		return;
+	}
+	channel->txShift = channel->txBuffer;
+	channel->txFull = false;
+	channel->txShifting = true;
+	schedAt(&channel->txEvent, totalTicks + sioCharCycles(channel));
+	// the buffer is empty again
+	if (channel->wr[1] & 0x02) {
+		daisyRequest(&channel->txIrq, totalTicks);
+	}
+}
+
+static void sioTxDone(void* context, uint64_t cycle) {
+	sioChannel_t* channel = (sioChannel_t*)context;
+	channel->txShifting = false;
+	channel->sent++;
+	if (channel->output) {
+		channel->output(channel->txShift);
+	}
+	if (channel->txFull && (channel->wr[5] & 0x08)) {
+		channel->txShift = channel->txBuffer;
+		channel->txFull = false;
+		channel->txShifting = true;
+		schedAt(&channel->txEvent, cycle + sioCharCycles(channel));
+		if (channel->wr[1] & 0x02) {
+			daisyRequest(&channel->txIrq, cycle);
+		}
+	}
+}
+
+static void sioStartRx(sioChannel_t* channel, uint64_t cycle) {
+	if (channel->inputPos < channel->inputLength && (channel->wr[3] & 0x01) && !schedPending(&channel->rxEvent)) {
+		schedAt(&channel->rxEvent, cycle + sioCharCycles(channel));
+	}
+}
+
+static void sioRxDone(void* context, uint64_t cycle) {
+	sioChannel_t* channel = (sioChannel_t*)context;
+	if (!(channel->wr[3] & 0x01)) {
+		return;
+	}
+	if (channel->rxAvailable) {
+		channel->overruns++;
+	}
+	channel->rxData = channel->input[channel->inputPos++];
+	channel->rxAvailable = true;
+	channel->received++;
+	const uint8_t mode = (channel->wr[1] >> 3) & 3;
+	if (mode >= 2 || (mode == 1 && channel->rxFirst)) {
+		channel->rxFirst = false;
+		daisyRequest(&channel->rxIrq, cycle);
+	}
+	sioStartRx(channel, cycle);
+}
+
+void sioFeed(int index, const uint8_t* data, size_t length) {
+	sioChannel_t* channel = &sio.channels[index];
+	channel->input = data;
+	channel->inputLength = length;
+	channel->inputPos = 0;
+	sioStartRx(channel, totalTicks);
+}
+
+static void sioReset(sioChannel_t* channel) {
+	for (int i = 0; i < 8; i++) {
+		channel->wr[i] = 0;
+	}
+	channel->pointer = 0;
+	channel->rxAvailable = channel->txFull = channel->txShifting = false;
+	channel->rxFirst = true;
+	schedCancel(&channel->rxEvent);
+	schedCancel(&channel->txEvent);
+	daisyWithdraw(&channel->rxIrq);
+	daisyWithdraw(&channel->txIrq);
+}
+
+static void sioCommand(sioChannel_t* channel, uint8_t command) {
+	switch (command) {
+		case 3:
+			sioReset(channel);
+			sioUpdateVectors();
+			break;
+		case 4:
+			channel->rxFirst = true;
+			break;
+		case 5:
+			daisyWithdraw(&channel->txIrq);
+			break;
+		case 7:
+			if (channel == &sio.channels[0]) {
+				// like a RETI, but only for the SIO's own sources
+				for (int i = 0; i < SIO_CHANNELS; i++) {
+					daisySource_t* sources[2] = { &sio.channels[i].rxIrq, &sio.channels[i].txIrq };
+					for (int j = 0; j < 2; j++) {
+						if (sources[j]->servicing) {
+							sources[j]->servicing = false;
+							return;
+						}
+					}
+				}
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+static void sioControl(sioChannel_t* channel, uint8_t data) {
+	const uint8_t reg = channel->pointer;
+	channel->pointer = 0;
+	if (reg == 0) {
+		channel->pointer = data & 7;
+		sioCommand(channel, (data >> 3) & 7);
+		return;
+	}
+	channel->wr[reg] = data;
+	switch (reg) {
+		case 1:
+			if (!(data & 0x02)) {
+				daisyWithdraw(&channel->txIrq);
+			}
+			if (!(data & 0x18)) {
+				daisyWithdraw(&channel->rxIrq);
+			}
+			sioUpdateVectors();
+			break;
+		case 2:
+			sioUpdateVectors();
+			break;
+		case 3:
+			sioStartRx(channel, totalTicks);
+			break;
+		case 5:
+			sioStartTx(channel);
+			break;
+		default:
+			break;
+	}
+}
+
+static uint8_t sioStatus(const sioChannel_t* channel) {
+	const uint8_t reg = channel->pointer;
+	switch (reg) {
+		case 0: return (channel->rxAvailable ? 0x01 : 0) | (channel->txFull ? 0 : 0x04) | 0x08 | 0x20;
+		case 1: return (channel->txFull || channel->txShifting) ? 0 : 0x01;
+		case 2:
+			if (channel == &sio.channels[1]) {
+				const daisySource_t* source = daisyRequester();
+				for (int i = 0; i < SIO_CHANNELS; i++) {
+					if (source == &sio.channels[i].rxIrq || source == &sio.channels[i].txIrq) {
+						return source->vector;
+					}
+				}
+				// nothing pending reads as channel B special receive condition
+				return (sio.channels[1].wr[1] & 0x04) ? (channel->wr[2] & 0xF1) | 0x06 : channel->wr[2];
+			}
+			return 0;
+		default: return 0;
+	}
+}
+
+static uint8_t sioRead(void* context, uint16_t address) {
+	(void)context;
+	const uint8_t offset = (uint8_t)(address - sio.port);
+	sioChannel_t* channel = &sio.channels[offset & 1];
+	if (offset >= SIO_CHANNELS) {
+		const uint8_t status = sioStatus(channel);
+		channel->pointer = 0;
+		return status;
+	}
+	channel->rxAvailable = false;
+	daisyWithdraw(&channel->rxIrq);
+	return channel->rxData;
+}
+
+static void sioWrite(void* context, uint16_t address, uint8_t data) {
+	(void)context;
+	const uint8_t offset = (uint8_t)(address - sio.port);
+	sioChannel_t* channel = &sio.channels[offset & 1];
+	if (offset >= SIO_CHANNELS) {
+		sioControl(channel, data);
+		return;
+	}
+	channel->txBuffer = data;
+	channel->txFull = true;
+	daisyWithdraw(&channel->txIrq);
+	sioStartTx(channel);
+}
+
+void sioInit(uint32_t clockCycles) {
+	static const char* names[SIO_CHANNELS][2] = { { "sioA rx", "sioA tx" }, { "sioB rx", "sioB tx" } };
+	sio.clockCycles = clockCycles ? clockCycles : 1;
+	for (int i = 0; i < SIO_CHANNELS; i++) {
+		sioChannel_t* channel = &sio.channels[i];
+		channel->rxData = 0;
+		channel->input = NULL;
+		channel->inputLength = channel->inputPos = 0;
+		channel->output = NULL;
+		channel->sent = channel->received = channel->overruns = 0;
+		schedInit(&channel->rxEvent, names[i][0], sioRxDone, channel);
+		schedInit(&channel->txEvent, names[i][1], sioTxDone, channel);
+		daisyInit(&channel->rxIrq, names[i][0]);
+		daisyInit(&channel->txIrq, names[i][1]);
+		sioReset(channel);
+	}
+	sioUpdateVectors();
+}
+
+void attachSIO(uint8_t port) {
+	sio.port = port;
+	ioRegisterRange(port, SIO_CHANNELS * 2, "sio", sioRead, sioWrite, &sio);
+	for (int i = 0; i < SIO_CHANNELS; i++) {
+		daisyAttach(&sio.channels[i].rxIrq);
+		daisyAttach(&sio.channels[i].txIrq);
+	}
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,150 @@
+#pragma once
+/*
+ * Pix80 periodic timer
+ *
+ * Raises a maskable interrupt every 'period' CPU cycles, through an
+ * event on the scheduler, so it costs nothing between interrupts. The
+ * request stays on the INT line until the CPU acknowledges it with an
+ * IORQ|M1 cycle, which puts the vector register on the data bus:
+ *
+ *   IM 0  the vector is executed as an opcode (0xFF, RST 38h, by default)
+ *   IM 1  the vector is ignored, the CPU calls 0x0038
+ *   IM 2  the vector is the low byte of the table entry at I * 256
+ *
+ * Five ports starting at the one it's attached to:
+ *
+ *   +0  read:  bit 0 running, bit 1 interrupt pending
+ *       write: bit 0 run (a 0 -> 1 change starts a new period now),
+ *              bit 1 drop a pending interrupt, for polling without
+ *              interrupts
+ *   +1  period bits 0-7
+ *   +2  period bits 8-15
+ *   +3  period bits 16-23, a new period takes effect with the next tick
+ *   +4  vector
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "pix80_io.h"
+#include "pix80_sched.h"
+
+#define TIMER_PORTS 5
+#define TIMER_MAX_PERIOD 0xFFFFFF
+
+typedef struct {
+	// first of its ports
+	uint8_t port;
+	uint32_t period;
+	uint8_t vector;
+	bool running;
+	// INT is asserted until the CPU acknowledges
+	bool pending;
+	schedEvent_t tick;
+	uint64_t ticks;
+	uint64_t acknowledged;
+	// ticks that came while the previous one was still pending
+	uint64_t missed;
+} timerDevice_t;
+
+extern timerDevice_t timer;
+
+void timerInit();
+// attach the timer's registers to TIMER_PORTS ports from 'port' on
+void attachTimer(uint8_t port);
+// start ticking every 'period' cycles from now, 0 stops the timer
+void timerStart(uint32_t period);
+// interrupt acknowledge cycle, returns what goes on the data bus
+uint8_t timerAcknowledge();
+
+static inline bool timerIntPending() {
+	return timer.pending;
+}
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+
+timerDevice_t timer;
+
+static void timerTick(void* context, uint64_t cycle) {
+	(void)context;
+	timer.ticks++;
+	if (timer.pending) {
+		timer.missed++;
+	}
+	timer.pending = true;
+	if (timer.period == 0) {
+		// zeroed while running
+		timer.running = false;
+		return;
+	}
+	// from when it was due, so late ticks don't add up
+	schedAt(&timer.tick, cycle + timer.period);
+}
+
+void timerInit() {
+	timer.period = 0;
+	timer.vector = 0xFF;
+	timer.running = timer.pending = false;
+	timer.ticks = timer.acknowledged = timer.missed = 0;
+	schedInit(&timer.tick, "timer", timerTick, NULL);
+}
+
+void timerStart(uint32_t period) {
+	timer.period = period;
+	timer.running = period != 0;
+	if (timer.running) {
+		schedAt(&timer.tick, totalTicks + period);
+	} else {
+		schedCancel(&timer.tick);
+	}
+}
+
+uint8_t timerAcknowledge() {
+	if (timer.pending) {
+		timer.pending = false;
+		timer.acknowledged++;
+	}
+	return timer.vector;
+}
+
+static uint8_t timerRead(void* context, uint16_t port) {
+	(void)context;
+	switch ((uint8_t)(port - timer.port)) {
+		case 0: return (timer.running ? 1 : 0) | (timer.pending ? 2 : 0);
+		case 1: return (uint8_t)timer.period;
+		case 2: return (uint8_t)(timer.period >> 8);
+		case 3: return (uint8_t)(timer.period >> 16);
+		default: return timer.vector;
+	}
+}
+
+static void timerWrite(void* context, uint16_t port, uint8_t data) {
+	(void)context;
+	switch ((uint8_t)(port - timer.port)) {
+		case 0:
+			if (data & 2) {
+				timer.pending = false;
+			}
+			if (!(data & 1)) {
+				// keeps the period for the next start
+				timer.running = false;
+				schedCancel(&timer.tick);
+			} else if (!timer.running) {
+				timerStart(timer.period);
+			}
+			break;
+		case 1: timer.period = (timer.period & 0xFFFF00) | data; break;
+		case 2: timer.period = (timer.period & 0xFF00FF) | (data << 8); break;
+		case 3: timer.period = (timer.period & 0x00FFFF) | (data << 16); break;
+		default: timer.vector = data; break;
+	}
+}
+
+void attachTimer(uint8_t port) {
+	timer.port = port;
+	ioRegisterRange(port, TIMER_PORTS, "timer", timerRead, timerWrite, &timer);
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,72 @@
+#pragma once
+/*
+ * Pix80 instruction trace
+ *
+ * A flight recorder: at every instruction boundary a fixed size
+ * binary record of the CPU state is written into a ring buffer.
+ * Recording is a handful of stores, nothing is formatted until
+ * the last records are dumped (on HALT, a crash or a signal).
+ *
+ * There's exactly one writer, the emulation loop. A reader, even a
+ * signal handler interrupting the writer, only ever looks at records
+ * that are older than traceCount, so no locking is needed.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include "z80.h"
+
+// must be a power of two
+#define TRACE_RING_SIZE (1 << 16)
+
+// CPU state right before the instruction at 'pc' executes
+typedef struct {
+	uint64_t cycle;
+	uint16_t pc;
+	uint16_t af, bc, de, hl, sp;
+	uint8_t opcode;
+	uint8_t bank;
+} traceRecord_t;
+
+extern traceRecord_t traceRing[TRACE_RING_SIZE];
+// total number of records ever written, the next one goes to traceCount % TRACE_RING_SIZE
+extern volatile uint64_t traceCount;
+
+// 'pc' and 'opcode' are the address and data bus of the opcode fetch that's in progress
+static inline void traceInstruction(const z80_t* cpu, uint16_t pc, uint8_t opcode, uint8_t bank, uint64_t cycle) {
+	const uint64_t index = traceCount;
+	traceRecord_t* record = &traceRing[index & (TRACE_RING_SIZE - 1)];
+	record->cycle = cycle;
+	record->pc = pc;
+	record->af = cpu->af;
+	record->bc = cpu->bc;
+	record->de = cpu->de;
+	record->hl = cpu->hl;
+	record->sp = cpu->sp;
+	record->opcode = opcode;
+	record->bank = bank;
+	// publish the record only once it's complete
+	__atomic_store_n(&traceCount, index + 1, __ATOMIC_RELEASE);
+}
+
+// The most records traceRecent() goes back, the oldest slot in the
+// ring is the one the writer fills next
+#define TRACE_RECENT_MAX (TRACE_RING_SIZE - 1)
+
+// return the n-th most recent record (0 is the newest), NULL if it was never written or got overwritten
+static inline const traceRecord_t* traceRecent(uint64_t n) {
+	const uint64_t count = __atomic_load_n(&traceCount, __ATOMIC_ACQUIRE);
+	if (n >= count || n >= TRACE_RECENT_MAX) {
+		return NULL;
+	}
+	return &traceRing[(count - 1 - n) & (TRACE_RING_SIZE - 1)];
+}
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+
+traceRecord_t traceRing[TRACE_RING_SIZE];
+volatile uint64_t traceCount = 0;
+
+#endif // CHIPS_IMPL
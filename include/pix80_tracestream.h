@@ -0,0 +1,312 @@
+#pragma once
+/*
+ * Pix80 streaming instruction trace
+ *
+ * For full traces of long runs. The emulation thread pushes the
+ * records of pix80_trace.h into a single-producer/single-consumer
+ * queue, a writer thread pops them, compresses them in blocks and
+ * writes the blocks to a file. The emulation thread never formats
+ * or writes anything itself, it only waits if the writer falls a
+ * whole queue behind.
+ *
+ * File format, all numbers little endian:
+ *
+ *   header  "PIX80TR1"
+ *   block   uint32 record count, uint32 payload size, payload
+ *   ...
+ *
+ * Every block starts from an all-zero record so it decodes on its
+ * own. Each record in the payload is stored as a delta against the
+ * previous one:
+ *
+ *   uint8   mask of changed fields (TRACE_CHANGED_*)
+ *   varint  cycles since the previous record
+ *   varint  zigzag encoded PC delta
+ *   uint8   opcode
+ *   uint16  each changed register, in mask order
+ *   uint8   bank, if changed
+ *
+ * which brings the typical record down from 24 to about 5 bytes.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "pix80_trace.h"
+
+#define TRACE_CHANGED_AF   (1 << 0)
+#define TRACE_CHANGED_BC   (1 << 1)
+#define TRACE_CHANGED_DE   (1 << 2)
+#define TRACE_CHANGED_HL   (1 << 3)
+#define TRACE_CHANGED_SP   (1 << 4)
+#define TRACE_CHANGED_BANK (1 << 5)
+
+// must be a power of two
+#define TRACE_QUEUE_SIZE (1 << 16)
+#define TRACE_BLOCK_RECORDS 4096
+
+// create the trace file and start the writer thread
+bool traceStreamOpen(const char* path);
+// write out everything that's still queued and stop the writer thread,
+// false if the trace file came out short
+bool traceStreamClose();
+// decode a trace file, calling 'visit' for every record in order,
+// false if it can't be read or is cut short
+bool traceStreamDecode(const char* path, void (*visit)(const traceRecord_t* record, void* user), void* user);
+
+extern traceRecord_t traceQueue[TRACE_QUEUE_SIZE];
+// written by the producer only
+extern volatile uint64_t traceQueueHead __attribute__((aligned(64)));
+// written by the writer thread only
+extern volatile uint64_t traceQueueTail __attribute__((aligned(64)));
+extern uint64_t traceQueueTailCache;
+
+void traceStreamWaitForSpace();
+
+static inline void traceStreamPush(const traceRecord_t* record) {
+	const uint64_t head = traceQueueHead;
+	if (head - traceQueueTailCache >= TRACE_QUEUE_SIZE) {
+		traceStreamWaitForSpace();
+	}
+	traceQueue[head & (TRACE_QUEUE_SIZE - 1)] = *record;
+	__atomic_store_n(&traceQueueHead, head + 1, __ATOMIC_RELEASE);
+}
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+traceRecord_t traceQueue[TRACE_QUEUE_SIZE];
+volatile uint64_t traceQueueHead __attribute__((aligned(64))) = 0;
+volatile uint64_t traceQueueTail __attribute__((aligned(64))) = 0;
+uint64_t traceQueueTailCache = 0;
+
+static FILE* traceFile = NULL;
+static pthread_t traceWriter;
+static volatile bool traceStopping = false;
+// a write came up short, the trace file is truncated
+static bool traceWriteFailed = false;
+
+static const char traceMagic[8] = { 'P', 'I', 'X', '8', '0', 'T', 'R', '1' };
+
+void traceStreamWaitForSpace() {
+	// The writer is a whole queue behind, give it the CPU
+	while (traceQueueHead - (traceQueueTailCache = __atomic_load_n(&traceQueueTail, __ATOMIC_ACQUIRE)) >= TRACE_QUEUE_SIZE) {
+		sched_yield();
+	}
+}
+
+static uint8_t* putVarint(uint8_t* out, uint64_t value) {
+	while (value >= 0x80) {
+		*out++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*out++ = (uint8_t)value;
+	return out;
+}
+
+static uint8_t* put16(uint8_t* out, uint16_t value) {
+	out[0] = value & 0xFF;
+	out[1] = value >> 8;
+	return out + 2;
+}
+
+static void writeBlock(const uint8_t* payload, uint32_t count, uint32_t size) {
+	uint8_t header[8];
+	for (int i = 0; i < 4; i++) {
+		header[i] = (count >> (i * 8)) & 0xFF;
+		header[4 + i] = (size >> (i * 8)) & 0xFF;
+	}
+	if (fwrite(header, 1, sizeof(header), traceFile) != sizeof(header) ||
+		fwrite(payload, 1, size, traceFile) != size) {
+		traceWriteFailed = true;
+	}
+}
+
+static void* traceWriterMain(void* arg) {
+	(void)arg;
+	// worst case per record: mask, 10 + 3 varint bytes, opcode, 5 registers, bank
+	static uint8_t block[TRACE_BLOCK_RECORDS * 26];
+	uint8_t* out = block;
+	uint32_t count = 0;
+	traceRecord_t previous;
+	memset(&previous, 0, sizeof(previous));
+	uint64_t tail = traceQueueTail;
+	for (;;) {
+		const uint64_t head = __atomic_load_n(&traceQueueHead, __ATOMIC_ACQUIRE);
+		if (tail == head) {
+			if (__atomic_load_n(&traceStopping, __ATOMIC_ACQUIRE)) {
+				// records pushed after head was read but before the stop
+				if (__atomic_load_n(&traceQueueHead, __ATOMIC_ACQUIRE) != tail) {
+					continue;
+				}
+				break;
+			}
+			struct timespec nap = { 0, 200000 };
+			nanosleep(&nap, NULL);
+			continue;
+		}
+		while (tail != head) {
+			const traceRecord_t* record = &traceQueue[tail & (TRACE_QUEUE_SIZE - 1)];
+			uint8_t mask = 0;
+			mask |= record->af != previous.af ? TRACE_CHANGED_AF : 0;
+			mask |= record->bc != previous.bc ? TRACE_CHANGED_BC : 0;
+			mask |= record->de != previous.de ? TRACE_CHANGED_DE : 0;
+			mask |= record->hl != previous.hl ? TRACE_CHANGED_HL : 0;
+			mask |= record->sp != previous.sp ? TRACE_CHANGED_SP : 0;
+			mask |= record->bank != previous.bank ? TRACE_CHANGED_BANK : 0;
+			*out++ = mask;
+			out = putVarint(out, record->cycle - previous.cycle);
+			const int16_t pcDelta = (int16_t)(record->pc - previous.pc);
+			out = putVarint(out, (uint16_t)(((uint16_t)pcDelta << 1) ^ (uint16_t)(pcDelta >> 15)));
+			*out++ = record->opcode;
+			if (mask & TRACE_CHANGED_AF) out = put16(out, record->af);
+			if (mask & TRACE_CHANGED_BC) out = put16(out, record->bc);
+			if (mask & TRACE_CHANGED_DE) out = put16(out, record->de);
+			if (mask & TRACE_CHANGED_HL) out = put16(out, record->hl);
+			if (mask & TRACE_CHANGED_SP) out = put16(out, record->sp);
+			if (mask & TRACE_CHANGED_BANK) *out++ = record->bank;
+			previous = *record;
+			tail++;
+			if (++count == TRACE_BLOCK_RECORDS) {
+				writeBlock(block, count, (uint32_t)(out - block));
+				out = block;
+				count = 0;
+				memset(&previous, 0, sizeof(previous));
+				__atomic_store_n(&traceQueueTail, tail, __ATOMIC_RELEASE);
+			}
+		}
+		__atomic_store_n(&traceQueueTail, tail, __ATOMIC_RELEASE);
+	}
+	if (count) {
+		writeBlock(block, count, (uint32_t)(out - block));
+	}
+	return NULL;
+}
+
+bool traceStreamOpen(const char* path) {
+	traceFile = fopen(path, "wb");
+	if (!traceFile) {
+		return false;
+	}
+	traceWriteFailed = fwrite(traceMagic, 1, sizeof(traceMagic), traceFile) != sizeof(traceMagic);
+	traceStopping = false;
+	if (pthread_create(&traceWriter, NULL, traceWriterMain, NULL) != 0) {
+		fclose(traceFile);
+		traceFile = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool traceStreamClose() {
+	if (!traceFile) {
+		return true;
+	}
+	__atomic_store_n(&traceStopping, true, __ATOMIC_RELEASE);
+	pthread_join(traceWriter, NULL);
+	// buffered data only goes out now, a full disk may only show here
+	const bool ok = !traceWriteFailed && !ferror(traceFile);
+	const bool closed = fclose(traceFile) == 0;
+	traceFile = NULL;
+	return ok && closed;
+}
+
+static const uint8_t* getVarint(const uint8_t* in, const uint8_t* end, uint64_t* value) {
+	*value = 0;
+	for (int shift = 0; in < end && shift < 64; shift += 7) {
+		const uint8_t byte = *in++;
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return in;
+		}
+	}
+	return NULL;
+}
+
+bool traceStreamDecode(const char* path, void (*visit)(const traceRecord_t* record, void* user), void* user) {
+	FILE* in = fopen(path, "rb");
+	if (!in) {
+		return false;
+	}
+	char magic[sizeof(traceMagic)];
+	if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, traceMagic, sizeof(magic)) != 0) {
+		fclose(in);
+		return false;
+	}
+	bool ok = true;
+	uint8_t* payload = NULL;
+	uint8_t header[8];
+	while (ok) {
+		const size_t got = fread(header, 1, sizeof(header), in);
+		if (got != sizeof(header)) {
+			// the stream may only end between two blocks
+			ok = got == 0 && !ferror(in);
+			break;
+		}
+		const uint32_t count = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+		const uint32_t size = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+		uint8_t* grown = (uint8_t*)realloc(payload, size ? size : 1);
+		if (!grown) {
+			ok = false;
+			break;
+		}
+		payload = grown;
+		if (fread(payload, 1, size, in) != size) {
+			ok = false;
+			break;
+		}
+		const uint8_t* at = payload;
+		const uint8_t* end = payload + size;
+		traceRecord_t record;
+		memset(&record, 0, sizeof(record));
+		for (uint32_t i = 0; i < count; i++) {
+			uint64_t cycles, pcDelta;
+			if (at >= end) {
+				ok = false;
+				break;
+			}
+			const uint8_t mask = *at++;
+			if (!(at = getVarint(at, end, &cycles)) || !(at = getVarint(at, end, &pcDelta)) || at >= end) {
+				ok = false;
+				break;
+			}
+			record.cycle += cycles;
+			record.pc += (uint16_t)((pcDelta >> 1) ^ (~(pcDelta & 1) + 1));
+			record.opcode = *at++;
+			uint16_t* registers[] = { &record.af, &record.bc, &record.de, &record.hl, &record.sp };
+			for (int r = 0; r < 5; r++) {
+				if (mask & (1 << r)) {
+					if (end - at < 2) {
+						ok = false;
+						break;
+					}
+					*registers[r] = at[0] | (at[1] << 8);
+					at += 2;
+				}
+			}
+			if (ok && (mask & TRACE_CHANGED_BANK)) {
+				if (at >= end) {
+					ok = false;
+				} else {
+					record.bank = *at++;
+				}
+			}
+			if (!ok) {
+				break;
+			}
+			visit(&record, user);
+		}
+	}
+	free(payload);
+	fclose(in);
+	return ok;
+}
+
+#endif // CHIPS_IMPL
@@ -0,0 +1,300 @@
+#pragma once
+/*
+ * Pix80 terminal UI
+ *
+ * A view of the running machine on the terminal, drawn by its own
+ * thread TUI_HZ times a second: the registers, the LCD and the last
+ * lines of serial output. The emulation thread never formats or
+ * writes any of it.
+ *
+ * The two threads share one snapshot of the machine behind a seqlock.
+ * The UI thread asks for a new one by setting tuiWanted, the emulation
+ * loop sees that between slices and calls tuiPublish(), which copies
+ * tuiState into the shared snapshot without ever waiting: the sequence
+ * number is odd while the copy is being made, a reader that saw an odd
+ * or changed number tries again. tuiState belongs to the emulation
+ * thread, it fills in the LCD pixels there and serial output goes into
+ * its scrollback through tuiSerial().
+ *
+ * The register panel comes from a callback, so it reads the same as
+ * the rest of the debug output.
+ *
+ * Define CHIPS_IMPL before including this file in *one* C file
+ * to create the implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "z80.h"
+
+#define TUI_HZ 30
+// bytes of serial output kept, must be a power of two
+#define TUI_SCROLLBACK (1 << 14)
+#define TUI_LCD_MAX_PIXELS (256 * 64)
+
+typedef struct {
+	z80_t cpu;
+	uint16_t pc;
+	uint8_t bank;
+	bool halted;
+	uint64_t ticks;
+	uint64_t instructions;
+	// host time of the snapshot, for the achieved clock
+	uint64_t hostNs;
+	// LCD pixel states as vrEmuLcdPixelState() gives them, no LCD when 0 x 0
+	int lcdWidth;
+	int lcdHeight;
+	char lcd[TUI_LCD_MAX_PIXELS];
+	// serial output ever written, the last TUI_SCROLLBACK bytes of it are kept
+	uint64_t serialCount;
+	uint8_t serial[TUI_SCROLLBACK];
+} tuiSnapshot_t;
+
+// writes the register panel for a snapshot into 'buffer', one or more lines
+typedef int (*tuiPanelFn)(char* buffer, size_t size, const tuiSnapshot_t* snapshot);
+
+// the emulation thread's side, published as a whole
+extern tuiSnapshot_t tuiState;
+// set by the UI thread when it wants a new snapshot
+extern volatile bool tuiWanted;
+
+// clear the terminal and start drawing, false if the thread can't be started
+bool tuiStart(tuiPanelFn panel);
+// copy tuiState to the UI thread, with the CPU state at an instruction boundary
+void tuiPublish(const z80_t* cpu, uint16_t pc, uint8_t bank, bool halted, uint64_t ticks, uint64_t instructions);
+// draw the last snapshot one more time, leave the cursor below it and stop the thread
+void tuiStop();
+// add serial output to the scrollback
+void tuiSerial(const uint8_t* data, uint32_t length);
+
+//-- IMPLEMENTATION ------------------------------------------------------------
+#ifdef CHIPS_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+tuiSnapshot_t tuiState;
+volatile bool tuiWanted = false;
+
+// written by the emulation thread only
+static tuiSnapshot_t tuiShared;
+static volatile uint32_t tuiSequence = 0;
+
+static pthread_t tuiThread;
+static volatile bool tuiRunning = false;
+static tuiPanelFn tuiPanel;
+// the UI thread's copy, and what it drew last
+static tuiSnapshot_t tuiView;
+static char* tuiScreen = NULL;
+static char* tuiLastScreen = NULL;
+static size_t tuiScreenSize = 0;
+
+void tuiSerial(const uint8_t* data, uint32_t length) {
+	for (uint32_t i = 0; i < length; i++) {
+		tuiState.serial[(tuiState.serialCount + i) & (TUI_SCROLLBACK - 1)] = data[i];
+	}
+	tuiState.serialCount += length;
+}
+
+void tuiPublish(const z80_t* cpu, uint16_t pc, uint8_t bank, bool halted, uint64_t ticks, uint64_t instructions) {
+	tuiWanted = false;
+	tuiState.cpu = *cpu;
+	tuiState.pc = pc;
+	tuiState.bank = bank;
+	tuiState.halted = halted;
+	tuiState.ticks = ticks;
+	tuiState.instructions = instructions;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	tuiState.hostNs = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+	const uint32_t sequence = tuiSequence;
+	__atomic_store_n(&tuiSequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&tuiShared, &tuiState, sizeof(tuiShared));
+	__atomic_store_n(&tuiSequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+// Copy the shared snapshot, false if there's nothing new since 'seen'
+static bool tuiRead(uint32_t* seen) {
+	for (;;) {
+		const uint32_t before = __atomic_load_n(&tuiSequence, __ATOMIC_ACQUIRE);
+		if (before == *seen) {
+			return false;
+		}
+		if (before & 1) {
+			sched_yield();
+			continue;
+		}
+		memcpy(&tuiView, &tuiShared, sizeof(tuiView));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&tuiSequence, __ATOMIC_RELAXED) == before) {
+			*seen = before;
+			return true;
+		}
+	}
+}
+
+// Append to the screen being built, as much as fits
+static void tuiAppend(size_t* length, const char* text, size_t count) {
+	if (*length + count > tuiScreenSize) {
+		count = tuiScreenSize - *length;
+	}
+	memcpy(tuiScreen + *length, text, count);
+	*length += count;
+}
+
+static size_t tuiDraw(const tuiSnapshot_t* view, int columns, int rows, double mhz) {
+	char line[512];
+	size_t length = 0;
+	// home, every line cleared to its end, the rest of the screen cleared after
+	tuiAppend(&length, "\x1b[H", 3);
+	int used = 0;
+	int n = tuiPanel(line, sizeof(line), view);
+	for (const char* at = line; at < line + n; used++) {
+		const char* end = (const char*)memchr(at, '\n', line + n - at);
+		const size_t count = end ? (size_t)(end - at) : (size_t)(line + n - at);
+		tuiAppend(&length, at, count < (size_t)columns ? count : (size_t)columns);
+		tuiAppend(&length, "\x1b[K\n", 4);
+		at += count + 1;
+	}
+	n = snprintf(line, sizeof(line), "Ticks: %llu  Instructions: %llu  %.3f MHz%s",
+		(unsigned long long)view->ticks, (unsigned long long)view->instructions, mhz, view->halted ? "  HALT" : "");
+	tuiAppend(&length, line, n < columns ? n : columns);
+	tuiAppend(&length, "\x1b[K\n\x1b[K\n", 8);
+	used += 2;
+	// the LCD, two pixel rows to a line with half blocks, borders blank
+	for (int y = 0; y < view->lcdHeight; y += 2, used++) {
+		for (int x = 0; x < view->lcdWidth && x < columns; x++) {
+			static const char* blocks[4] = { " ", "\xe2\x96\x80", "\xe2\x96\x84", "\xe2\x96\x88" };
+			const bool top = view->lcd[y * view->lcdWidth + x] > 0;
+			const bool bottom = y + 1 < view->lcdHeight && view->lcd[(y + 1) * view->lcdWidth + x] > 0;
+			const char* block = blocks[top | (bottom << 1)];
+			tuiAppend(&length, block, strlen(block));
+		}
+		tuiAppend(&length, "\x1b[K\n", 4);
+	}
+	if (view->lcdHeight) {
+		tuiAppend(&length, "\x1b[K\n", 4);
+		used++;
+	}
+	// as many of the last serial lines as fit below
+	const int lines = rows - used - 1;
+	const uint64_t kept = view->serialCount < TUI_SCROLLBACK ? view->serialCount : TUI_SCROLLBACK;
+	uint64_t start = view->serialCount;
+	for (int found = 0; start > view->serialCount - kept; start--) {
+		if (view->serial[(start - 1) & (TUI_SCROLLBACK - 1)] == '\n' && start != view->serialCount && ++found == lines) {
+			break;
+		}
+	}
+	int column = 0;
+	for (uint64_t i = start; i < view->serialCount && lines > 0; i++) {
+		const uint8_t c = view->serial[i & (TUI_SCROLLBACK - 1)];
+		if (c == '\n') {
+			tuiAppend(&length, "\x1b[K\n", 4);
+			column = 0;
+		} else if (column < columns && c != '\r') {
+			const char shown = (c >= 0x20 && c < 0x7F) ? (char)c : '.';
+			tuiAppend(&length, &shown, 1);
+			column++;
+		}
+	}
+	tuiAppend(&length, "\x1b[J", 3);
+	return length;
+}
+
+static void tuiWrite(const char* data, size_t length) {
+	while (length) {
+		const ssize_t written = write(STDOUT_FILENO, data, length);
+		if (written <= 0) {
+			return;
+		}
+		data += written;
+		length -= (size_t)written;
+	}
+}
+
+static void tuiRender(uint32_t* seen, uint64_t* lastTicks, uint64_t* lastNs, double* mhz) {
+	if (!tuiRead(seen)) {
+		return;
+	}
+	if (tuiView.hostNs > *lastNs && tuiView.ticks >= *lastTicks && *lastNs) {
+		*mhz = (tuiView.ticks - *lastTicks) * 1e3 / (double)(tuiView.hostNs - *lastNs);
+	}
+	*lastTicks = tuiView.ticks;
+	*lastNs = tuiView.hostNs;
+	struct winsize size;
+	int columns = 80, rows = 24;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col && size.ws_row) {
+		columns = size.ws_col;
+		rows = size.ws_row;
+	}
+	const size_t length = tuiDraw(&tuiView, columns, rows, *mhz);
+	// nothing changed on screen, don't write it again
+	if (memcmp(tuiScreen, tuiLastScreen, length) != 0 || tuiLastScreen[length] != '\0') {
+		tuiWrite(tuiScreen, length);
+		memcpy(tuiLastScreen, tuiScreen, length);
+		tuiLastScreen[length] = '\0';
+	}
+}
+
+static void* tuiMain(void* arg) {
+	(void)arg;
+	uint32_t seen = 0;
+	uint64_t lastTicks = 0, lastNs = 0;
+	double mhz = 0.0;
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (__atomic_load_n(&tuiRunning, __ATOMIC_ACQUIRE)) {
+		tuiRender(&seen, &lastTicks, &lastNs, &mhz);
+		__atomic_store_n(&tuiWanted, true, __ATOMIC_RELEASE);
+		next.tv_nsec += 1000000000L / TUI_HZ;
+		if (next.tv_nsec >= 1000000000L) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000L;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+	// the last state, whatever it was
+	tuiRender(&seen, &lastTicks, &lastNs, &mhz);
+	return NULL;
+}
+
+bool tuiStart(tuiPanelFn panel) {
+	tuiPanel = panel;
+	// LCD half blocks are 3 bytes each, plus line ends for a large terminal
+	tuiScreenSize = 3 * TUI_LCD_MAX_PIXELS + (1 << 18);
+	tuiScreen = (char*)malloc(tuiScreenSize);
+	tuiLastScreen = (char*)calloc(tuiScreenSize + 1, 1);
+	if (!tuiScreen || !tuiLastScreen) {
+		return false;
+	}
+	// clear the screen and hide the cursor
+	tuiWrite("\x1b[2J\x1b[?25l", 10);
+	tuiWanted = true;
+	tuiRunning = true;
+	if (pthread_create(&tuiThread, NULL, tuiMain, NULL) != 0) {
+		tuiRunning = false;
+		tuiWrite("\x1b[?25h", 6);
+		return false;
+	}
+	return true;
+}
+
+void tuiStop() {
+	if (!tuiRunning) {
+		return;
+	}
+	__atomic_store_n(&tuiRunning, false, __ATOMIC_RELEASE);
+	pthread_join(tuiThread, NULL);
+	tuiWrite("\x1b[?25h\n", 7);
+	free(tuiScreen);
+	free(tuiLastScreen);
+	tuiScreen = tuiLastScreen = NULL;
+}
+
+#endif // CHIPS_IMPL
@@ -22,7 +22,39 @@
   ((byte) & 0x01 ? '1' : '0') 
   
 #define CHIPS_IMPL
+#ifdef PIX80_Z80_GOTO
+// z80.h's own z80_tick() is built under another name, see compile.sh -g
+#define z80_tick z80_tickSwitch
+#endif
 #include "./include/z80.h"
+#ifdef PIX80_Z80_GOTO
+#undef z80_tick
+#include PIX80_Z80_GOTO
+#endif
+#include "./include/pix80_io.h"
+#include "./include/pix80_memory.h"
+#include "./include/pix80_sched.h"
+#include "./include/pix80_loader.h"
+#include "./include/pix80_trace.h"
+#include "./include/pix80_tracestream.h"
+#include "./include/pix80_serial.h"
+#include "./include/pix80_timer.h"
+#include "./include/pix80_daisy.h"
+#include "./include/pix80_ctc.h"
+#include "./include/pix80_pio.h"
+#include "./include/pix80_sio.h"
+#ifdef PIX80_LCD
+#include "./include/pix80_lcd.h"
+#endif
+#include "./include/pix80_lcdstream.h"
+#include "./include/pix80_lcdhash.h"
+#include "./include/pix80_tui.h"
+#include "./include/pix80_profile.h"
+#include "./include/pix80_callgraph.h"
+#include "./include/pix80_ops.h"
+#include "./include/pix80_jit.h"
+#include "./include/pix80_recompile.h"
+#include "./include/pix80_fastcore.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,6 +62,8 @@
 #include <time.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
 //#include <SDL2/SDL.h>
 
 // Utility macros
@@ -41,23 +75,74 @@
         } \
     } while(0)
 
-bool running = true;
+volatile bool running = true;
+volatile bool dumpRequested = false;
 //SDL_Event event;
 int delayTime;
 unsigned char infoFlag = 2;
-int currentBank = 0;
 char latestKeyboardCharacter;
 uint16_t addr;
 z80_t cpu;
 
-// Initalize all memory
-uint8_t onBoardROM[(1<<14)] = { 0 };
-// Initalize all memory
-uint8_t onBoardRAM[(1<<15)] = { 0 };
+// Clock scheduler
+// The CPU is run in time slices worth SLICE_NS of emulated time,
+// after which we sleep once until the slice's absolute deadline.
+#define SLICE_NS 1000000ULL
+double targetMHz = 4.0;
+// Run as fast as the host allows, no sleeping at all
+bool unthrottled = false;
+// Stop after this many ticks, 0 runs forever
+uint64_t maxTicks = 0;
+// Drive the CPU tick by tick rather than instruction by instruction
+bool tickStep = false;
+// Number of 16 KB banks available to the Banking Area
+int bankCount = MEM_MAX_BANKS;
+// Records of the instruction trace to decode on HALT, crash or signal,
+// tracing is off when this is 0
+uint64_t traceDumpCount = 0;
+// Stream every instruction's trace record to a file
+bool traceStreaming = false;
+// Count cycles and instructions per address, see pix80_profile.h
+bool profiling = false;
+// Follow calls and returns for folded stacks, see pix80_callgraph.h
+bool callGraphing = false;
+// Run hot code through the JIT
+bool useJIT = false;
+// Run the ROM code that was recompiled into this build
+bool useAOT = false;
+// Run on the instruction-atomic core instead of the cycle-stepped one
+bool fastCore = false;
+// Switch to the cycle-stepped core after this many ticks, 0 never
+uint64_t fastUntilTicks = 0;
+// Run LDIR, CPIR, OTIR and co. on the host in one go rather than
+// every iteration on the bus
+bool hostBlocks = true;
+// Start the timer with this period at reset, 0 leaves it to the ROM
+uint32_t timerPeriod = 0;
+// CPU cycles per SIO clock, with the x16 divider about 9600 baud at 4 MHz
+#define SIO_CLOCK_CYCLES 26
+// Bytes that arrive on SIO channel A, one per character time
+const char* sioInputPath = NULL;
+// Size of the character LCD, when it's built in
+int lcdCols = 16;
+int lcdRows = 2;
+// Record the LCD frames that changed to this file
+const char* lcdStreamPath = NULL;
+// Write a hash of every LCD frame to this file, compare them with the golden one
+const char* lcdHashPath = NULL;
+const char* lcdGoldenPath = NULL;
+// Show the machine on a terminal UI instead of printing serial output
+bool tuiEnabled = false;
+// Exit code when the CPU halts with nothing left that could wake it
+int haltExitCode = 0;
+bool halted = false;
+// Ticks the CPU spent in HALT that were skipped rather than run
+uint64_t haltSkippedTicks = 0;
+uint64_t totalInstructions = 0;
 
 const char* decodeFlags(uint8_t flags) {
-	// 8 because it stores 8 chars, 0 indexed
-	static char textFlags[8] = "-------";
+	// 8 chars plus the terminator, 0 indexed, the terminal UI has its own
+	static __thread char textFlags[9] = "--------";
 	 // Carry
 	if ((flags & Z80_CF) != 0) {
 		textFlags[7] = 'C';
@@ -116,77 +201,624 @@ const char* decodeFlags(uint8_t flags) {
 	return textFlags;
 }
 
-void printDebugInfo() {
-    switch (infoFlag) {
-	    case 1:
-		    printf("AF: %04hX - BC: %04hX - DE: %04hX - HL: %04hX - ADDR: %04hX BANK:%02hX\n", cpu.af, cpu.bc, cpu.de, cpu.hl, cpu.pc, currentBank);
-		    break;
-	    case 2:
-		    printf("%s | A: %02hX | B: %02hX - C: %02hX | D: %02hX - E: %02hX | H: %02hX - L: %02hX | OP: %02hX ADDR: %04hX BANK:%02hX\n", decodeFlags(cpu.f), cpu.a, cpu.b, cpu.c, cpu.d, cpu.e, cpu.h, cpu.l, cpu.opcode, cpu.pc, currentBank);
-		    break;
-	    default:
-		    break;
-    }
+// Format a trace record the way debug level 1 or 2 shows it
+int formatTraceRecord(char* buffer, size_t size, const traceRecord_t* record, int level) {
+	const uint8_t a = record->af >> 8, f = record->af & 0xFF;
+	if (level == 1) {
+		return snprintf(buffer, size, "AF: %04hX - BC: %04hX - DE: %04hX - HL: %04hX - ADDR: %04hX BANK:%02hX",
+			record->af, record->bc, record->de, record->hl, record->pc, record->bank);
+	}
+	return snprintf(buffer, size, "%s | A: %02hX | B: %02hX - C: %02hX | D: %02hX - E: %02hX | H: %02hX - L: %02hX | OP: %02hX ADDR: %04hX BANK:%02hX",
+		decodeFlags(f), a, record->bc >> 8, record->bc & 0xFF, record->de >> 8, record->de & 0xFF,
+		record->hl >> 8, record->hl & 0xFF, record->opcode, record->pc, record->bank);
 }
 
-uint8_t readMappedMemory(uint16_t address) {
-    if (address < 0x4000) {
-        // Constant ROM
-		return onBoardROM[address];
-    } else if (address < 0x8000) {
-        // Banking Area
-		// Check with the I/O Object how it's memory is set up
-		return 0;
-    } else if (address >= 0x8000) {
-        // Constant RAM
-		return onBoardRAM[address-0x8000];
-    }
-    // Outside of mapable memory!
-    return 0;
+void printDebugInfo(const traceRecord_t* record) {
+	char line[256];
+	switch (infoFlag) {
+		case 1:
+		case 2:
+			formatTraceRecord(line, sizeof(line), record, infoFlag);
+			printf("%s\n", line);
+			break;
+		default:
+			break;
+	}
 }
 
-uint8_t writeMappedMemory(uint16_t address, uint8_t data) {
-    if (address < 0x4000) {
-        // Constant ROM
-		// Can't write to ROM :^)
-    } else if (address < 0x8000) {
-        // Banking Area
-		// Check with the I/O Object how it's memory is set up
-		return 0;
-    } else if (address >= 0x8000) {
-        // Constant RAM
-		onBoardRAM[address-0x8000] = data;
-    }
-    // Outside of mapable memory!
-    return 0;
+// The terminal UI's register panel
+int formatRegisterPanel(char* buffer, size_t size, const tuiSnapshot_t* snapshot) {
+	const z80_t* regs = &snapshot->cpu;
+	return snprintf(buffer, size,
+		"PC: %04hX  SP: %04hX  BANK: %02hX  %s\n"
+		"A: %02hX  BC: %04hX  DE: %04hX  HL: %04hX  IX: %04hX  IY: %04hX\n"
+		"AF': %04hX  BC': %04hX  DE': %04hX  HL': %04hX  I: %02hX  R: %02hX  IM %d  IFF %d/%d",
+		snapshot->pc, regs->sp, snapshot->bank, decodeFlags(regs->f),
+		regs->a, regs->bc, regs->de, regs->hl, regs->ix, regs->iy,
+		regs->af2, regs->bc2, regs->de2, regs->hl2, regs->i, regs->r, regs->im, regs->iff1, regs->iff2);
+}
+
+// Hand the terminal UI a new snapshot
+void publishTui(uint64_t pins) {
+#ifdef PIX80_LCD
+	int width, height;
+	vrEmuLcdNumPixels(lcd.display, &width, &height);
+	if (width * height <= TUI_LCD_MAX_PIXELS) {
+		tuiState.lcdWidth = width;
+		tuiState.lcdHeight = height;
+		lcdPixels(tuiState.lcd);
+	}
+#endif
+	tuiPublish(&cpu, Z80_GET_ADDR(pins), currentBank, (pins & Z80_HALT) != 0, totalTicks, totalInstructions);
+}
+
+void printDecodedRecord(const traceRecord_t* record, void* user) {
+	(void)user;
+	char line[256];
+	formatTraceRecord(line, sizeof(line), record, 2);
+	puts(line);
+}
+
+#ifdef PIX80_LCD
+// Pixels of the frame being recorded or hashed
+char* lcdFramePixels = NULL;
+size_t lcdFramePixelCount = 0;
+// Hash of what the LCD shows, only changes with a redraw
+uint64_t lcdFrameHash = 0;
+
+// What the LCD shows, down to the cursor but not its blink, which isn't
+// on emulated time and would make the hashes differ from run to run
+uint64_t hashLcdState() {
+	const uint16_t cursor = lcdStill(lcdFramePixels);
+	uint8_t state[10];
+	const uint64_t hash = lcdHashPixels(lcdFramePixels, lcdFramePixelCount);
+	memcpy(state, &hash, sizeof(hash));
+	state[8] = (uint8_t)(cursor >> 8);
+	state[9] = (uint8_t)cursor;
+	return lcdHashPixels((const char*)state, sizeof(state));
+}
+
+void recordLcdFrame(uint64_t frame, uint64_t cycle, bool redrawn) {
+	if (redrawn) {
+		lcdPixels(lcdFramePixels);
+		lcdStreamFrame(frame, cycle, lcdFramePixels);
+	}
+}
+
+void hashLcdFrame(uint64_t frame, uint64_t cycle, bool redrawn) {
+	(void)frame;
+	if (redrawn) {
+		lcdFrameHash = hashLcdState();
+	}
+	lcdHashFrame(cycle, lcdFrameHash);
+}
+#endif
+
+// Formatting for dumpTrace(), which the crash handler calls and where
+// snprintf() isn't safe to use
+static char* putText(char* at, const char* text) {
+	while (*text) {
+		*at++ = *text++;
+	}
+	return at;
+}
+
+static char* putHex(char* at, unsigned value, int digits) {
+	while (digits--) {
+		*at++ = "0123456789ABCDEF"[(value >> (digits * 4)) & 0xF];
+	}
+	return at;
+}
+
+// right aligned in 'width' characters
+static char* putDecimal(char* at, uint64_t value, int width) {
+	char digits[20];
+	int count = 0;
+	do {
+		digits[count++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+	for (; width > count; width--) {
+		*at++ = ' ';
+	}
+	while (count) {
+		*at++ = digits[--count];
+	}
+	return at;
+}
+
+// Decode the last 'count' records of the instruction trace to stderr,
+// as debug level 2 shows them. Only uses write() and formats on its
+// own, so this is also called from the crash handler.
+void dumpTrace(uint64_t count) {
+	char line[160];
+	if (count == 0) {
+		return;
+	}
+	if (count > TRACE_RECENT_MAX) {
+		count = TRACE_RECENT_MAX;
+	}
+	char* at = putText(line, "--- Last ");
+	at = putDecimal(at, count, 0);
+	at = putText(at, " instructions ---\n");
+	write(STDERR_FILENO, line, at - line);
+	for (uint64_t n = count; n-- > 0;) {
+		const traceRecord_t* record = traceRecent(n);
+		if (!record) {
+			continue;
+		}
+		at = putDecimal(line, record->cycle, 12);
+		at = putText(at, " | SP: ");
+		at = putHex(at, record->sp, 4);
+		at = putText(at, " | ");
+		for (int bit = 7; bit >= 0; bit--) {
+			const char flag = "CNPXHXZS"[bit];
+			*at++ = (record->af & (1 << bit)) ? flag : (char)(flag | 0x20);
+		}
+		at = putText(at, " | A: ");
+		at = putHex(at, record->af >> 8, 2);
+		at = putText(at, " | B: ");
+		at = putHex(at, record->bc >> 8, 2);
+		at = putText(at, " - C: ");
+		at = putHex(at, record->bc & 0xFF, 2);
+		at = putText(at, " | D: ");
+		at = putHex(at, record->de >> 8, 2);
+		at = putText(at, " - E: ");
+		at = putHex(at, record->de & 0xFF, 2);
+		at = putText(at, " | H: ");
+		at = putHex(at, record->hl >> 8, 2);
+		at = putText(at, " - L: ");
+		at = putHex(at, record->hl & 0xFF, 2);
+		at = putText(at, " | OP: ");
+		at = putHex(at, record->opcode, 2);
+		at = putText(at, " ADDR: ");
+		at = putHex(at, record->pc, 4);
+		at = putText(at, " BANK:");
+		at = putHex(at, record->bank, 2);
+		*at++ = '\n';
+		write(STDERR_FILENO, line, at - line);
+	}
+}
+
+uint64_t monotonicNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void handleSignal(int sig) {
+	if (sig == SIGUSR1) {
+		dumpRequested = true;
+		return;
+	}
+	running = false;
+}
+
+// Only what's safe in a signal handler, the crash may have been inside stdio
+void handleCrash(int sig) {
+	serialFlushRaw();
+	char line[48];
+	char* at = putText(line, "\nEmulator crashed (signal ");
+	at = putDecimal(at, (uint64_t)sig, 0);
+	at = putText(at, ")\n");
+	write(STDERR_FILENO, line, at - line);
+	dumpTrace(traceDumpCount);
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+void printUsage(const char* name) {
+	fprintf(stderr, "Usage: %s [options] <rom.bin>\n", name);
+	fprintf(stderr, "       %s [options] -M <manifest>\n", name);
+	fprintf(stderr, "       %s -D <trace file>\n", name);
+	fprintf(stderr, "  -f, --clock <MHz>   target CPU clock (default 4)\n");
+	fprintf(stderr, "  -i, --info <level>  debug output, 0 = off, 1 = registers, 2 = registers + flags (default 0)\n");
+	fprintf(stderr, "  -m, --max-speed     don't throttle, run as fast as the host allows\n");
+	fprintf(stderr, "  -n, --ticks <n>     stop after n clock ticks\n");
+	fprintf(stderr, "  -t, --tick-step     drive the CPU one tick at a time instead of per instruction\n");
+	fprintf(stderr, "  -b, --banks <n>     number of 16 KB memory banks (default %d)\n", MEM_MAX_BANKS);
+	fprintf(stderr, "  -M, --manifest <f>  place ROM and bank segments as listed in a manifest\n");
+	fprintf(stderr, "  -d, --dump <n>      record an instruction trace and decode the last n\n");
+	fprintf(stderr, "                      instructions on HALT, crash, exit or SIGUSR1\n");
+	fprintf(stderr, "  -T, --trace-file <f> stream a compressed trace of every instruction to a file\n");
+	fprintf(stderr, "  -D, --decode-trace <f> print a trace file in the -i 2 format and exit\n");
+	fprintf(stderr, "  -S, --serial-fd <fd> write serial output straight to a file descriptor\n");
+	fprintf(stderr, "  -F, --serial-flush <n> flush serial output after it's waited n cycles (default 100000)\n");
+	fprintf(stderr, "  -j, --jit           translate hot code to native code (not with -t, -i, -d, -T, -p or -g)\n");
+	fprintf(stderr, "  -A, --aot           run the ROM code recompiled into this build (same restrictions)\n");
+	fprintf(stderr, "  -R, --recompile <f> translate the ROM into C for ./compile.sh <f> and exit\n");
+	fprintf(stderr, "  -E, --entry <addr>  another entry point for -R, besides 0x0000, 0x0038 and 0x0066\n");
+	fprintf(stderr, "  -c, --core <name>   'fast' runs whole instructions at a time, 'cycle' steps every\n");
+	fprintf(stderr, "                      clock cycle on the bus (default)\n");
+	fprintf(stderr, "  -u, --fast-until <n> run on the fast core for n ticks, then switch to the cycle core\n");
+	fprintf(stderr, "  -P, --fast-until-pc <addr> run on the fast core until PC reaches addr, then switch\n");
+	fprintf(stderr, "                      (-i, -d and -T only see what the cycle core runs)\n");
+	fprintf(stderr, "  -I, --timer <n>     interrupt every n cycles from reset on, the ROM can reprogram it\n");
+	fprintf(stderr, "  -L, --lcd <c>x<r>   columns and rows of the LCD (default 16x2), see compile.sh\n");
+	fprintf(stderr, "  -O, --lcd-stream <f> record the LCD's changing frames to a file\n");
+	fprintf(stderr, "  -V, --render-lcd <f> render an LCD stream to <f>-<frame>.ppm images and exit\n");
+	fprintf(stderr, "  -H, --lcd-hash <f>  write the cycle and a hash of every LCD frame to a file\n");
+	fprintf(stderr, "  -G, --lcd-golden <f> compare the LCD frame hashes with an earlier -H file, stop at the first difference\n");
+	fprintf(stderr, "  -p, --profile <f>   write where the cycles went to a file at exit\n");
+	fprintf(stderr, "  -g, --folded <f>    write the cycles per call stack to a file at exit, for flame graphs\n");
+	fprintf(stderr, "  -y, --symbols <f>   pasmo symbol file, -p then also adds up the cycles per label\n");
+	fprintf(stderr, "                      and -g names the stack frames after them\n");
+	fprintf(stderr, "  -U, --tui           show registers, LCD and serial output on a terminal UI\n");
+	fprintf(stderr, "  -K, --sio-input <f> feed a file into SIO channel A's receiver\n");
+	fprintf(stderr, "  -x, --halt-exit <n> exit code when the CPU halts with interrupts disabled (default 0)\n");
+	fprintf(stderr, "  -B, --exact-blocks  run LDIR, CPIR, OTIR etc. on the cycle core one bus cycle at a time\n");
+}
+
+// Level of the INT line, every device that can interrupt drives it
+static inline uint64_t interruptPins() {
+	return (daisyIntPending() || timerIntPending()) ? Z80_INT : 0;
+}
+
+// Where the CPU has to stop next, at the next event or the end of the
+// slice. Asked again after every step, the devices it talks to may
+// have posted an earlier event.
+static inline uint64_t runLimit(uint64_t sliceEnd) {
+	const uint64_t next = schedNext();
+	return next < sliceEnd ? next : sliceEnd;
+}
+
+// Handle the memory or I/O request of the last tick
+static inline uint64_t serviceBus(uint64_t pins) {
+	// handle memory read or write access
+	addr = Z80_GET_ADDR(pins);
+	if (pins & Z80_MREQ) {
+		if (pins & Z80_RD) {
+			// Read Instructions
+			Z80_SET_DATA(pins, readMappedMemory(addr));
+		}
+		else if (pins & Z80_WR) {
+			// If writing to memory
+			writeMappedMemory(addr,Z80_GET_DATA(pins));
+		}
+	} else if (pins & Z80_IORQ) { // Handle I/O Devices
+		// Might make use of the fact
+		// the B register does shit too another time lmao
+		// (devices get the whole 16 bit address)
+		if (pins & Z80_M1) {
+			// interrupt acknowledge, the daisy chain goes before the timer,
+			// which isn't a Z80 family chip and doesn't watch for RETI
+			Z80_SET_DATA(pins, daisyIntPending() ? daisyAcknowledge(totalTicks) : timerAcknowledge());
+			if (callGraphing) {
+				callGraphInterrupt();
+			}
+		}
+		else if (pins & Z80_RD) {
+			Z80_SET_DATA(pins, ioRead(addr));
+		}
+		else if (pins & Z80_WR) {
+			ioWrite(addr, Z80_GET_DATA(pins));
+		}
+		// that may have changed who's requesting an interrupt
+		pins = (pins & ~Z80_INT) | interruptPins();
+	} else if (pins & Z80_RETI) {
+		// the tick that decodes RETI has no bus request of its own,
+		// lower priority devices on the chain may interrupt again
+		daisyReti();
+		pins = (pins & ~Z80_INT) | interruptPins();
+	}
+	return pins;
+}
+
+// Bookkeeping at an instruction boundary, the next opcode fetch is on the bus
+static inline void instructionDone(uint64_t pins) {
+	totalInstructions++;
+	if (profiling) {
+		profileInstruction(Z80_GET_ADDR(pins), currentBank, totalTicks, totalInstructions);
+	}
+	if (callGraphing) {
+		callGraphInstruction(Z80_GET_ADDR(pins), currentBank, cpu.sp, totalTicks, totalInstructions);
+	}
+	if (traceDumpCount || infoFlag || traceStreaming) {
+		traceInstruction(&cpu, Z80_GET_ADDR(pins), Z80_GET_DATA(pins), currentBank, totalTicks);
+		if (traceStreaming) {
+			traceStreamPush(traceRecent(0));
+		}
+		// Debug Info
+		if (infoFlag) {
+			printDebugInfo(traceRecent(0));
+		}
+	}
+	if ((pins & Z80_HALT) && !halted) {
+		halted = true;
+		if (traceDumpCount) {
+			dumpTrace(traceDumpCount);
+		}
+	}
+}
+
+// Tick the machine by a single clock cycle
+uint64_t tickMachine(uint64_t pins) {
+	// tick the CPU
+	pins = serviceBus(z80_tick(&cpu, pins));
+	totalTicks++;
+	if (z80_opdone(&cpu)) {
+		instructionDone(pins);
+	}
+	return pins;
+}
+
+// Run the machine until the CPU has finished its current instruction,
+// or has reached 'until' in the middle of it, the next call then goes
+// on from there. Gives the same results as calling tickMachine() that
+// often, but keeps the bus handling inside one tight loop.
+uint64_t stepInstruction(uint64_t pins, uint64_t until) {
+	do {
+		pins = serviceBus(z80_tick(&cpu, pins));
+		totalTicks++;
+	} while (!z80_opdone(&cpu) && totalTicks < until);
+	if (z80_opdone(&cpu)) {
+		instructionDone(pins);
+	}
+	return pins;
+}
+
+// In HALT the CPU runs one 4 T-state M1 cycle after the other, each
+// only bumping R. Jump to the last of those boundaries at or before
+// 'until', where running through them would have got to too.
+void skipHalt(uint64_t until) {
+	if (until <= totalTicks) {
+		return;
+	}
+	const uint64_t repeats = (until - totalTicks) / 4;
+	cpu.r = (cpu.r & 0x80) | ((cpu.r + repeats) & 0x7F);
+	totalTicks += repeats * 4;
+	totalInstructions += repeats;
+	haltSkippedTicks += repeats * 4;
+}
+
+// Hand over to the cycle-stepped core, it goes on from wherever the
+// fast one stopped, in the middle of an instruction too
+void leaveFastCore(const char* reason) {
+	fastCore = false;
+	fastBreakpoint = -1;
+	fprintf(stderr, "Switching to the cycle-stepped core %s, PC %04X, tick %llu\n",
+		reason, (uint16_t)(cpu.pc - 1), (unsigned long long)totalTicks);
+}
+
+// Run a repeating block instruction on the host, or a recompiled or
+// translated block if the instruction being fetched starts one,
+// otherwise run on the fast core or a single instruction on the
+// cycle-stepped core
+uint64_t stepTranslated(uint64_t pins, uint64_t until) {
+	// Interrupts are only ever taken by the cycle-stepped core, INT may
+	// have been raised since the last tick and not be in int_bits yet
+	const bool interrupt = (cpu.int_bits & Z80_NMI) || (((cpu.int_bits | pins) & Z80_INT) && cpu.iff1);
+	if (cpu.step != 0 || interrupt || (pins & Z80_HALT)) {
+		return stepInstruction(pins, until);
+	}
+	const uint16_t pc = Z80_GET_ADDR(pins);
+	if (fastCore && pc == fastBreakpoint) {
+		leaveFastCore("at the breakpoint");
+	}
+	const uint64_t budget = until - totalTicks;
+	z80BlockResult_t result;
+	if (!(hostBlocks && fastBlockRun(&cpu, pc, budget, &result)) &&
+		!(useAOT && aotRun(&cpu, pc, budget, &result)) && !(useJIT && jitRun(&cpu, pc, budget, &result)) &&
+		// next to translated code one instruction at a time, so blocks still get their turn
+		!(fastCore && fastRun(&cpu, pc, (useJIT || useAOT || profiling || callGraphing) && budget > FAST_MAX_CYCLES ?
+			FAST_MAX_CYCLES : budget, &result))) {
+		return stepInstruction(pins, until);
+	}
+	// The block's first T-state was the fetch that's already on the bus,
+	// the tick below is the first T-state of the instruction after it
+	totalTicks += result.cycles;
+	totalInstructions += result.instructions - 1;
+	// its I/O may have changed who's requesting an interrupt, z80_tick()
+	// would have seen that in its last cycle and takes it right away
+	pins = z80_prefetch(&cpu, cpu.pc) | (pins & (Z80_NMI | Z80_WAIT)) | interruptPins();
+	cpu.int_bits = (cpu.int_bits & Z80_NMI) | (pins & Z80_INT);
+	pins = serviceBus(z80_tick(&cpu, pins));
+	// taking an interrupt isn't a boundary of its own, same as on z80_tick()
+	if (z80_opdone(&cpu)) {
+		instructionDone(pins);
+	}
+	return pins;
 }
 
 int main(int argc, char **argv) {
-	// Get the delayTime for slowmode in milliseconds
-	// delayTime = atoi(argv[2]);
-	//infoFlag = atoi(argv[2]);
+	static const struct option longOptions[] = {
+		{ "clock", required_argument, NULL, 'f' },
+		{ "info",  required_argument, NULL, 'i' },
+		{ "max-speed", no_argument,   NULL, 'm' },
+		{ "ticks", required_argument, NULL, 'n' },
+		{ "tick-step", no_argument,   NULL, 't' },
+		{ "banks", required_argument, NULL, 'b' },
+		{ "manifest", required_argument, NULL, 'M' },
+		{ "dump",  required_argument, NULL, 'd' },
+		{ "trace-file", required_argument, NULL, 'T' },
+		{ "decode-trace", required_argument, NULL, 'D' },
+		{ "serial-fd", required_argument, NULL, 'S' },
+		{ "serial-flush", required_argument, NULL, 'F' },
+		{ "jit",   no_argument,         NULL, 'j' },
+		{ "aot",   no_argument,         NULL, 'A' },
+		{ "recompile", required_argument, NULL, 'R' },
+		{ "entry", required_argument,   NULL, 'E' },
+		{ "core",  required_argument,   NULL, 'c' },
+		{ "fast-until", required_argument, NULL, 'u' },
+		{ "fast-until-pc", required_argument, NULL, 'P' },
+		{ "exact-blocks", no_argument, NULL, 'B' },
+		{ "halt-exit", required_argument, NULL, 'x' },
+		{ "timer", required_argument, NULL, 'I' },
+		{ "sio-input", required_argument, NULL, 'K' },
+		{ "lcd",   required_argument,   NULL, 'L' },
+		{ "lcd-stream", required_argument, NULL, 'O' },
+		{ "render-lcd", required_argument, NULL, 'V' },
+		{ "lcd-hash", required_argument, NULL, 'H' },
+		{ "lcd-golden", required_argument, NULL, 'G' },
+		{ "tui",   no_argument,         NULL, 'U' },
+		{ "profile", required_argument, NULL, 'p' },
+		{ "symbols", required_argument, NULL, 'y' },
+		{ "folded", required_argument,  NULL, 'g' },
+		{ "help",  no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	infoFlag = 0;
+	const char* manifestPath = NULL;
+	const char* traceFilePath = NULL;
+	int serialFd = -1;
+	uint64_t serialFlushInterval = 100000;
+	const char* recompilePath = NULL;
+	const char* profilePath = NULL;
+	const char* symbolPath = NULL;
+	const char* foldedPath = NULL;
+	// Reset, the IM 1 interrupt handler and the NMI handler
+	uint16_t entries[256] = { 0x0000, 0x0038, 0x0066 };
+	int entryCount = 3;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "f:i:mn:tb:M:d:T:D:S:F:jAR:E:c:u:P:Bx:I:K:L:O:V:H:G:Up:y:g:h", longOptions, NULL)) != -1) {
+		switch (opt) {
+			case 'f':
+				targetMHz = atof(optarg);
+				CHECK_ERROR(targetMHz <= 0.0, "Clock must be a positive number of MHz");
+				break;
+			case 'i':
+				infoFlag = atoi(optarg);
+				break;
+			case 'm':
+				unthrottled = true;
+				break;
+			case 'n':
+				maxTicks = strtoull(optarg, NULL, 0);
+				break;
+			case 't':
+				tickStep = true;
+				break;
+			case 'b':
+				bankCount = atoi(optarg);
+				CHECK_ERROR(bankCount < 0 || bankCount > MEM_MAX_BANKS, "Bank count must be between 0 and 256");
+				break;
+			case 'M':
+				manifestPath = optarg;
+				break;
+			case 'd':
+				traceDumpCount = strtoull(optarg, NULL, 0);
+				break;
+			case 'T':
+				traceFilePath = optarg;
+				break;
+			case 'D':
+				CHECK_ERROR(!traceStreamDecode(optarg, printDecodedRecord, NULL), "Couldn't decode the trace file");
+				return 0;
+			case 'S':
+				serialFd = atoi(optarg);
+				break;
+			case 'F':
+				serialFlushInterval = strtoull(optarg, NULL, 0);
+				break;
+			case 'j':
+				useJIT = true;
+				break;
+			case 'A':
+				useAOT = true;
+				break;
+			case 'R':
+				recompilePath = optarg;
+				break;
+			case 'E':
+				CHECK_ERROR(entryCount == 256, "Too many entry points");
+				entries[entryCount++] = (uint16_t)strtoul(optarg, NULL, 0);
+				break;
+			case 'c':
+				CHECK_ERROR(strcmp(optarg, "fast") != 0 && strcmp(optarg, "cycle") != 0, "The core must be 'fast' or 'cycle'");
+				fastCore = strcmp(optarg, "fast") == 0;
+				break;
+			case 'u':
+				fastUntilTicks = strtoull(optarg, NULL, 0);
+				fastCore = true;
+				break;
+			case 'P':
+				fastBreakpoint = (int32_t)(strtoul(optarg, NULL, 0) & 0xFFFF);
+				fastCore = true;
+				break;
+			case 'B':
+				hostBlocks = false;
+				break;
+			case 'x':
+				haltExitCode = atoi(optarg);
+				break;
+			case 'I':
+				timerPeriod = (uint32_t)strtoul(optarg, NULL, 0);
+				CHECK_ERROR(timerPeriod > TIMER_MAX_PERIOD, "The timer period can be at most 16777215 cycles");
+				break;
+			case 'K':
+				sioInputPath = optarg;
+				break;
+			case 'L':
+				CHECK_ERROR(sscanf(optarg, "%dx%d", &lcdCols, &lcdRows) != 2, "The LCD size goes like 16x2");
+#ifndef PIX80_LCD
+				fprintf(stderr, "This build has no LCD, see compile.sh\n");
+#endif
+				break;
+			case 'O':
+#ifdef PIX80_LCD
+				lcdStreamPath = optarg;
+#else
+				fprintf(stderr, "This build has no LCD, see compile.sh\n");
+#endif
+				break;
+			case 'U':
+				tuiEnabled = true;
+				break;
+			case 'p':
+				profilePath = optarg;
+				break;
+			case 'y':
+				symbolPath = optarg;
+				break;
+			case 'g':
+				foldedPath = optarg;
+				break;
+			case 'H':
+			case 'G':
+#ifdef PIX80_LCD
+				*(opt == 'H' ? &lcdHashPath : &lcdGoldenPath) = optarg;
+#else
+				// a golden test that can't run mustn't pass
+				fprintf(stderr, "This build has no LCD to hash, see compile.sh\n");
+				return 1;
+#endif
+				break;
+			case 'V': {
+				char prefix[4096];
+				snprintf(prefix, sizeof(prefix), "%s-", optarg);
+				CHECK_ERROR(!lcdStreamRender(optarg, prefix), "Couldn't render the LCD stream");
+				return 0;
+			}
+			default:
+				printUsage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc && !manifestPath) {
+		printUsage(argv[0]);
+		return 1;
+	}
 		
-    // 32 KB of ROM memory (0x0000 - 0x7FFF)
+    // 16 KB of ROM memory (0x0000 - 0x3FFF)
+	// 16 KB of banked memory (0x4000 - 0x7FFF)
 	// 32 KB of RAM memory (0x8000 - 0xFFFF)
-	FILE *in_file;
-	if ((in_file = fopen(argv[1], "rb"))) { // read only
-		// file exists
-		printf("Loading ROM from %s\n",argv[1]);
-		// Find out filesize
-		fseek(in_file, 0L, SEEK_END);
-		int filesize = ftell(in_file);
-		rewind(in_file);
-		// Print file info
-		printf("File is 0x%04hX Bytes large\n",filesize);
+	CHECK_ERROR(!initMemoryMap(), "Couldn't allocate the memory map");
+	CHECK_ERROR(!initBankPool(bankCount), "Couldn't allocate the memory banks");
+	
+	// Map ROM and banks, nothing is copied
+	if (manifestPath) {
+		printf("Loading manifest %s\n", manifestPath);
+		CHECK_ERROR(!loadManifest(manifestPath), "Couldn't load the manifest");
 	} else {
-		printf("No file found!\n");
-		return 1;
+		const char* romPath = argv[optind];
+		printf("Loading ROM from %s\n", romPath);
+		CHECK_ERROR(!loadImage(romPath), "Couldn't load the ROM");
+	}
+	if (recompilePath) {
+		CHECK_ERROR(!recompileROM(recompilePath, entries, entryCount, manifestPath ? manifestPath : argv[optind]),
+			"Couldn't write the recompiled ROM");
+		return 0;
 	}
-	
-	// Load ROM file into Memory
-	size_t bytes_read = 0;
-	bytes_read = fread(onBoardROM, sizeof(unsigned char), 0x4000, in_file);
-	printf("ROM of size 0x%04hX/0x4000 was loaded\n",(int)bytes_read);
 
     // initialize Z80 CPU
     uint64_t pins = z80_init(&cpu);
@@ -194,58 +826,365 @@ int main(int argc, char **argv) {
 	// reset Z80 CPU for it to be in a known state
 	z80_reset(&cpu);
 	
+	// Attach all I/O devices
+	initIO();
+	// Memory Bank Selector
+	attachBankSelector(0b00000000);
+	// Most likely where the Serial Port will be
+	serialInit(serialFd, serialFlushInterval);
+	attachSerial(0b00100000);
+	if (tuiEnabled && !isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "The terminal UI needs a terminal on stdout, it stays off\n");
+		tuiEnabled = false;
+	}
+	if (tuiEnabled) {
+		// serial output goes to the UI's console, and to -S if given
+		serial.sink = tuiSerial;
+		if (infoFlag) {
+			fprintf(stderr, "Debug output doesn't go with the terminal UI, it stays off\n");
+			infoFlag = 0;
+		}
+	}
+	// Periodic timer, ports 0x10 - 0x14
+	timerInit();
+	attachTimer(0b00010000);
+	if (timerPeriod) {
+		timerStart(timerPeriod);
+	}
+	// Z80 CTC, PIO and SIO, ports 0x40 - 0x4B, daisy chained in that order
+	ctcInit();
+	attachCTC(0b01000000);
+	pioInit();
+	attachPIO(0b01000100);
+	sioInit(SIO_CLOCK_CYCLES);
+	attachSIO(0b01001000);
+	// channel A is another way out to the serial output
+	sio.channels[0].output = serialWrite;
+	if (sioInputPath) {
+		size_t sioInputLength = 0;
+		const uint8_t* sioInput = mapFile(sioInputPath, &sioInputLength);
+		CHECK_ERROR(!sioInput, "Couldn't read the SIO input file");
+		sioFeed(0, sioInput, sioInputLength);
+	}
+#ifdef PIX80_LCD
+	// HD44780 LCD, ports 0x30 - 0x31
+	CHECK_ERROR(!lcdInit(lcdCols, lcdRows, (uint64_t)(targetMHz * 1e6 / LCD_FRAME_HZ)), "Couldn't create the LCD");
+	attachLCD(0b00110000);
+	if (lcdStreamPath || lcdHashPath || lcdGoldenPath) {
+		int width, height;
+		vrEmuLcdNumPixels(lcd.display, &width, &height);
+		lcdFramePixelCount = (size_t)width * height;
+		lcdFramePixels = (char*)malloc(lcdFramePixelCount);
+		CHECK_ERROR(!lcdFramePixels, "Out of memory");
+		// the border only shows once the pixels have been drawn
+		vrEmuLcdUpdatePixels(lcd.display);
+		lcdPixels(lcdFramePixels);
+		if (lcdStreamPath) {
+			CHECK_ERROR(!lcdStreamOpen(lcdStreamPath, width, height, lcdFramePixels, lcd.framePeriod),
+				"Couldn't create the LCD stream file");
+			lcdOnFrame(recordLcdFrame);
+		}
+		if (lcdHashPath || lcdGoldenPath) {
+			lcdFrameHash = hashLcdState();
+			CHECK_ERROR(!lcdHashOpen(lcdHashPath, lcdGoldenPath), "Couldn't open the LCD hash files");
+			lcdOnFrame(hashLcdFrame);
+		}
+	}
+#endif
+	if (traceFilePath) {
+		CHECK_ERROR(!traceStreamOpen(traceFilePath), "Couldn't create the trace file");
+		traceStreaming = true;
+	}
+	if (profilePath) {
+		CHECK_ERROR(!profileInit(totalTicks, totalInstructions), "Couldn't allocate the profile");
+		profiling = true;
+	}
+	if (foldedPath) {
+		CHECK_ERROR(!callGraphInit(Z80_GET_ADDR(pins), cpu.sp, totalTicks, totalInstructions), "Couldn't allocate the call graph");
+		callGraphing = true;
+	}
+	// Translated blocks skip the per-instruction bookkeeping
+	if ((useJIT || useAOT) && (tickStep || infoFlag || traceDumpCount || traceStreaming || profiling || callGraphing)) {
+		fprintf(stderr, "Translated code doesn't work with -t, -i, -d, -T, -p or -g, it stays off\n");
+		useJIT = useAOT = false;
+	}
+	// Neither do host block instructions, every iteration is traced on its own
+	if (infoFlag || traceDumpCount || traceStreaming) {
+		hostBlocks = false;
+	}
+	if (useJIT) {
+		CHECK_ERROR(!jitInit(), "Couldn't allocate the JIT's code buffer");
+	}
+	if (useAOT && !aotInit()) {
+		useAOT = false;
+	}
+	
+	// Stop cleanly on Ctrl+C so the clock report still gets printed
+	signal(SIGINT, handleSignal);
+	signal(SIGTERM, handleSignal);
+	signal(SIGUSR1, handleSignal);
+	if (traceDumpCount) {
+		signal(SIGSEGV, handleCrash);
+		signal(SIGBUS, handleCrash);
+		signal(SIGILL, handleCrash);
+		signal(SIGFPE, handleCrash);
+		signal(SIGABRT, handleCrash);
+	}
+	
+	if (tuiEnabled) {
+		CHECK_ERROR(!tuiStart(formatRegisterPanel), "Couldn't start the terminal UI");
+	}
+
 	// ---------------------- Actual Emulation ----------------------
 	// run code until HALT pin (active low) goes low
 	//int refreshTimer = SDL_GetTicks();
+	const double ticksPerNs = targetMHz / 1000.0;
+	const uint64_t sliceTicks = (uint64_t)(ticksPerNs * SLICE_NS) > 0 ? (uint64_t)(ticksPerNs * SLICE_NS) : 1;
+	const uint64_t startNs = monotonicNs();
+	// Emulated time is anchored to this point, if the host falls
+	// too far behind we re-anchor instead of bursting to catch up
+	uint64_t anchorNs = startNs;
+	uint64_t anchorTicks = 0;
+	uint64_t laggingSlices = 0;
+	int exitCode = 0;
 	while(running) {
-        // tick the CPU
-		// Wait to simulate CPU Clock
-		usleep(100000);
-		pins = z80_tick(&cpu, pins);
-		
-		// Debug Info
-		if (infoFlag) {
-		    printDebugInfo();
+		// Run one slice worth of cycles, then wait once
+		uint64_t sliceEnd = totalTicks + sliceTicks;
+		if (fastCore && fastUntilTicks) {
+			if (totalTicks >= fastUntilTicks) {
+				leaveFastCore("after the given ticks");
+			} else if (fastUntilTicks < sliceEnd) {
+				// end the slice right at the switch
+				sliceEnd = fastUntilTicks;
+			}
+		}
+		if (maxTicks && maxTicks <= sliceEnd) {
+			sliceEnd = maxTicks;
+			running = false;
+		}
+		// Within the slice the CPU runs undisturbed up to the next event
+		bool stopped = false;
+		while (totalTicks < sliceEnd) {
+			const uint64_t until = runLimit(sliceEnd);
+			// A halted CPU only waits for an interrupt, and nothing
+			// can bring one before the next event
+			if ((pins & Z80_HALT) && z80_opdone(&cpu)) {
+				if ((cpu.int_bits & Z80_NMI) || (((cpu.int_bits | pins) & Z80_INT) && cpu.iff1)) {
+					// taking the interrupt ends the HALT
+					pins = stepInstruction(pins, until);
+				} else if (!cpu.iff1) {
+					fprintf(stderr, "CPU halted with interrupts disabled at %04X, tick %llu\n",
+						(uint16_t)(cpu.pc - 1), (unsigned long long)totalTicks);
+					exitCode = haltExitCode;
+					stopped = true;
+					break;
+				} else {
+					skipHalt(until);
+					// and on into the next M1 cycle, up to 'until' itself
+					if (totalTicks < until) {
+						pins = stepInstruction(pins, until);
+					}
+				}
+			}
+			// The loops below stop at a HALT, so the rest is skipped too.
+			// They all stop right at the next event, in the middle of an
+			// instruction if need be, so it fires on the same tick as
+			// with -t and an interrupt it raises is taken just as early.
+			if (tickStep && !fastCore) {
+				while (totalTicks < runLimit(sliceEnd) && !((pins & Z80_HALT) && z80_opdone(&cpu))) {
+					pins = tickMachine(pins);
+				}
+			} else if (useJIT || useAOT || fastCore) {
+				for (uint64_t limit; totalTicks < (limit = runLimit(sliceEnd)) && !((pins & Z80_HALT) && z80_opdone(&cpu));) {
+					pins = stepTranslated(pins, limit);
+				}
+			} else {
+				for (uint64_t limit; totalTicks < (limit = runLimit(sliceEnd)) && !((pins & Z80_HALT) && z80_opdone(&cpu));) {
+					// the opcode being fetched is on the bus, only ED can start a block instruction
+					if (hostBlocks && Z80_GET_DATA(pins) == 0xED) {
+						pins = stepTranslated(pins, limit);
+					} else {
+						pins = stepInstruction(pins, limit);
+					}
+				}
+			}
+			schedRunDue(totalTicks);
+			pins = (pins & ~Z80_INT) | interruptPins();
+#ifdef PIX80_LCD
+			if (lcdHash.mismatch) {
+				// a golden test failed, the rest of the run can't fix it
+				exitCode = 1;
+				stopped = true;
+				break;
+			}
+#endif
+		}
+		if (stopped) {
+			break;
 		}
 		//SDL_Delay(delayTime);
+		if (tuiWanted) {
+			publishTui(pins);
+		}
+		if (dumpRequested) {
+			dumpRequested = false;
+			dumpTrace(traceDumpCount);
+		}
+		if (unthrottled) {
+			continue;
+		}
 
-		// handle memory read or write access
-        addr = Z80_GET_ADDR(pins);
-		if (pins & Z80_MREQ) {
-			if (pins & Z80_RD) {
-				// Read Instructions
-				Z80_SET_DATA(pins, readMappedMemory(addr));
+		// The deadline is derived from the total tick count rather
+		// than by adding up slice lengths, so rounding never drifts
+		const uint64_t deadlineNs = anchorNs + (uint64_t)((totalTicks - anchorTicks) / ticksPerNs);
+		const uint64_t nowNs = monotonicNs();
+		if (nowNs < deadlineNs) {
+			struct timespec ts;
+			ts.tv_sec = deadlineNs / 1000000000ULL;
+			ts.tv_nsec = deadlineNs % 1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		} else if (nowNs - deadlineNs > 100 * SLICE_NS) {
+			if (laggingSlices == 0) {
+				fprintf(stderr, "Host can't keep up with %.3f MHz!\n", targetMHz);
 			}
-			else if (pins & Z80_WR) {
-				// If writing to memory
-                writeMappedMemory(addr,Z80_GET_DATA(pins));
-			}
-		} else if (pins & Z80_IORQ) { // Handle I/O Devices
-		    // Might make use of the fact
-		    // the B register does shit too another time lmao
-		    switch(addr & 0xFF) {
-		        // Memory Bank Selector
-		        case 0b00000000:
-		            if (pins & Z80_WR) {
-		                currentBank = Z80_GET_DATA(pins);
-		            }
-		            break;
-		        // Most likely where the Serial Port will be
-		        case 0b00100000:
-		            if (pins & Z80_WR) {
-		                putchar(Z80_GET_DATA(pins));
-		                //printf("%c", Z80_GET_DATA(pins));
-		            }
-		            break;
-		        default:
-		            if (infoFlag) {
-		                printf("Unassigned Device!");
-		            }
-		            break;
-		    }
+			laggingSlices++;
+			anchorNs = nowNs;
+			anchorTicks = totalTicks;
 		}
     }
 	
+	if (traceDumpCount) {
+		dumpTrace(traceDumpCount);
+	}
+	if (!traceStreamClose()) {
+		fprintf(stderr, "Couldn't write the whole trace, the trace file is truncated\n");
+		exitCode = 1;
+	}
+	if (!lcdStreamClose()) {
+		fprintf(stderr, "Couldn't write the whole LCD stream, the stream file is truncated\n");
+		exitCode = 1;
+	}
+#ifdef PIX80_LCD
+	if (!lcdHashClose()) {
+		if (lcdHash.writeFailed) {
+			fprintf(stderr, "Couldn't write all LCD frame hashes\n");
+		}
+		exitCode = 1;
+	}
+#endif
+	serialFlush();
+	if (profiling) {
+		// the last instruction's cycles so far
+		profileInstruction(Z80_GET_ADDR(pins), currentBank, totalTicks, totalInstructions);
+		if (!profileReport(profilePath, symbolPath)) {
+			fprintf(stderr, "Couldn't write the profile\n");
+		}
+	}
+	if (callGraphing) {
+		callGraphInstruction(Z80_GET_ADDR(pins), currentBank, cpu.sp, totalTicks, totalInstructions);
+		if (!callGraphWrite(foldedPath, symbolPath)) {
+			fprintf(stderr, "Couldn't write the folded stacks\n");
+		}
+	}
+	if (tuiEnabled) {
+		publishTui(pins);
+		tuiStop();
+	}
+	
+	const double elapsedS = (monotonicNs() - startNs) / 1e9;
+	const double achievedMHz = elapsedS > 0.0 ? totalTicks / elapsedS / 1e6 : 0.0;
+	if (unthrottled) {
+		const double mips = elapsedS > 0.0 ? totalInstructions / elapsedS / 1e6 : 0.0;
+		fprintf(stderr, "\nTicks: %llu, Instructions: %llu, Wall time: %.3f s\n",
+			(unsigned long long)totalTicks, (unsigned long long)totalInstructions, elapsedS);
+		fprintf(stderr, "Throughput: %.3f MHz, %.3f MIPS\n", achievedMHz, mips);
+		fprintf(stderr, "Serial: %llu bytes in %llu writes\n",
+			(unsigned long long)serial.bytesWritten, (unsigned long long)serial.flushes);
+		if (timer.ticks) {
+			fprintf(stderr, "Timer: %llu interrupts, %llu acknowledged, %llu missed\n",
+				(unsigned long long)timer.ticks, (unsigned long long)timer.acknowledged,
+				(unsigned long long)timer.missed);
+		}
+		for (int i = 0; i < daisyChain.count; i++) {
+			const daisySource_t* source = daisyChain.sources[i];
+			if (source->requests) {
+				fprintf(stderr, "Interrupt %s: %llu requested, %llu acknowledged, latency %.1f cycles average, %llu max\n",
+					source->name, (unsigned long long)source->requests, (unsigned long long)source->acknowledged,
+					source->acknowledged ? (double)source->latencyTotal / source->acknowledged : 0.0,
+					(unsigned long long)source->latencyMax);
+			}
+		}
+		for (int i = 0; i < SIO_CHANNELS; i++) {
+			const sioChannel_t* channel = &sio.channels[i];
+			if (channel->sent || channel->received) {
+				fprintf(stderr, "SIO %c: %llu sent, %llu received, %llu overruns\n", 'A' + i,
+					(unsigned long long)channel->sent, (unsigned long long)channel->received,
+					(unsigned long long)channel->overruns);
+			}
+		}
+#ifdef PIX80_LCD
+		if (lcd.commands || lcd.dataWrites) {
+			fprintf(stderr, "LCD: %llu commands, %llu data writes, %llu of %llu frames redrawn\n",
+				(unsigned long long)lcd.commands, (unsigned long long)lcd.dataWrites,
+				(unsigned long long)lcd.updates, (unsigned long long)lcd.frames);
+			if (lcdStreamPath) {
+				fprintf(stderr, "LCD stream: %llu frames, %llu rectangles\n",
+					(unsigned long long)lcdStream.framesWritten, (unsigned long long)lcdStream.rectsWritten);
+			}
+			lcdRefresh();
+			// what it showed last, border pixels left blank
+			int width, height;
+			vrEmuLcdNumPixels(lcd.display, &width, &height);
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					const char pixel = vrEmuLcdPixelState(lcd.display, x, y);
+					fputc(pixel < 0 ? ' ' : (pixel ? '#' : '.'), stderr);
+				}
+				fputc('\n', stderr);
+			}
+		}
+		if (lcdGoldenPath) {
+			fprintf(stderr, "LCD golden: %llu of %llu frames compared, %llu golden frames not reached, %s\n",
+				(unsigned long long)lcdHash.compared, (unsigned long long)lcdHash.frames,
+				(unsigned long long)lcdHash.missed, lcdHash.mismatch ? "mismatch" : "all match");
+		}
+#endif
+		if (callGraphing) {
+			fprintf(stderr, "Call graph: %llu calls, %llu interrupts, %llu returns, %llu stack switches, %llu calls dropped\n",
+				(unsigned long long)callGraph.calls, (unsigned long long)callGraph.interrupts,
+				(unsigned long long)callGraph.returns, (unsigned long long)callGraph.switches,
+				(unsigned long long)callGraph.dropped);
+		}
+		if (haltSkippedTicks) {
+			fprintf(stderr, "Halted: %llu ticks skipped\n", (unsigned long long)haltSkippedTicks);
+		}
+		if (fastStats.runs) {
+			fprintf(stderr, "Fast core: %llu instructions in %llu runs\n",
+				(unsigned long long)fastStats.instructions, (unsigned long long)fastStats.runs);
+		}
+		if (fastStats.blockRuns) {
+			fprintf(stderr, "Block instructions: %llu iterations in %llu runs\n",
+				(unsigned long long)fastStats.blockIterations, (unsigned long long)fastStats.blockRuns);
+		}
+		if (useJIT) {
+			fprintf(stderr, "JIT: %llu blocks run, %llu translated, %llu code writes, %llu flushes\n",
+				(unsigned long long)jitStats.blocksRun, (unsigned long long)jitStats.translated,
+				(unsigned long long)jitStats.invalidated, (unsigned long long)jitStats.flushes);
+		}
+	} else {
+		fprintf(stderr, "\nClock: achieved %.3f MHz of target %.3f MHz (%.1f%%) over %.3f s\n",
+			achievedMHz, targetMHz, achievedMHz / targetMHz * 100.0, elapsedS);
+	}
+	for (int port = 0; port < 256; port++) {
+		if (ioUnassigned[port].reads || ioUnassigned[port].writes) {
+			fprintf(stderr, "Unassigned port %02X: %llu reads, %llu writes\n", port,
+				(unsigned long long)ioUnassigned[port].reads, (unsigned long long)ioUnassigned[port].writes);
+		}
+	}
+	if (laggingSlices) {
+		fprintf(stderr, "Host fell behind %llu times\n", (unsigned long long)laggingSlices);
+	}
+	
 	// Used to halt the Emulator in case of an error (i.e. no ROM to execute etc.)
-	return 0;
+	return exitCode;
 }
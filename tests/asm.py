@@ -0,0 +1,57 @@
+# Just enough of an assembler to build the test ROMs: bytes, 16 bit
+# words, labels and relative jumps, resolved by done()
+class Assembler:
+	def __init__(self, org=0):
+		self.code = bytearray()
+		self.org = org
+		self.labels = {}
+		self.fixups = []
+
+	def pc(self):
+		return self.org + len(self.code)
+
+	def label(self, name):
+		self.labels[name] = self.pc()
+
+	def db(self, *values):
+		self.code += bytes(values)
+
+	def dw(self, value):
+		if isinstance(value, str):
+			self.fixups.append(('word', len(self.code), value))
+			value = 0
+		self.code += bytes([value & 0xFF, (value >> 8) & 0xFF])
+
+	# an opcode with a 16 bit operand, a number or a label
+	def nn(self, opcode, value):
+		self.db(opcode)
+		self.dw(value)
+
+	# an opcode with a relative jump to a label
+	def jr(self, opcode, name):
+		self.db(opcode)
+		self.fixups.append(('relative', len(self.code), name))
+		self.db(0)
+
+	def out(self, port, value=None):
+		if value is not None:
+			self.db(0x3E, value)
+		self.db(0xD3, port)
+
+	def pad(self, address):
+		self.code += bytes(address - self.pc())
+
+	# the ROM image, padded to 'size'
+	def done(self, size=None):
+		for kind, at, name in self.fixups:
+			target = self.labels[name]
+			if kind == 'word':
+				self.code[at] = target & 0xFF
+				self.code[at + 1] = target >> 8
+			else:
+				offset = target - (self.org + at + 1)
+				assert -128 <= offset < 128, name
+				self.code[at] = offset & 0xFF
+		if size:
+			self.pad(self.org + size)
+		return bytes(self.code)
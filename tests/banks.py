@@ -0,0 +1,30 @@
+# The bank switching benchmark ROM: 2000 times calls into each of the
+# two banks at 0x4000, printing what they return, and patches the code
+# in bank 1 every time, then halts
+import sys
+from asm import Assembler
+
+a = Assembler()
+a.nn(0x31, 0xFFF0)                 # ld sp,0xFFF0
+a.nn(0x21, 2000)                   # ld hl,2000
+a.label('loop')
+a.out(0x00, 0x00)                  # bank 0
+a.nn(0xCD, 0x4000)                 # call 0x4000
+a.out(0x20)
+a.out(0x00, 0x01)                  # bank 1
+a.nn(0xCD, 0x4000)                 # call 0x4000
+a.out(0x20)
+# bank 1 starts with LD A,n, count n through '0' to '7'
+a.nn(0x3A, 0x4001)                 # ld a,(0x4001)
+a.db(0x3C, 0xE6, 0x07, 0xC6, 0x30) # inc a ; and 7 ; add a,'0'
+a.nn(0x32, 0x4001)                 # ld (0x4001),a
+a.db(0x2B, 0x7C, 0xB5)             # dec hl ; ld a,h ; or l
+a.nn(0xC2, 'loop')                 # jp nz,loop
+a.out(0x20, 0x0A)
+a.db(0x76)                         # halt
+rom = a.done(0x4000)
+
+# LD A,n ; LD B,count ; loop: INC A ; DJNZ loop ; RET
+bank0 = bytes([0x3E, 0x41, 0x06, 0x05, 0x3C, 0x10, 0xFD, 0xC9])
+bank1 = bytes([0x3E, 0x30, 0x06, 0x03, 0x3C, 0x10, 0xFD, 0xC9])
+open(sys.argv[1], 'wb').write(rom + bank0.ljust(0x4000, b'\0') + bank1.ljust(0x4000, b'\0'))
@@ -0,0 +1,72 @@
+# The benchmark ROM: fills and sums a page, calls a subroutine and a
+# copy of some code in RAM that patches itself, prints a letter per
+# round and a newline every 256 rounds, forever
+import sys
+from asm import Assembler
+
+# LD A,0x30 ; LD C,A ; LD B,0x20 ; loop: ADD A,C ; DJNZ loop ; LD (0x8100),A ; RET
+ram = [0x3E, 0x30, 0x4F, 0x06, 0x20, 0x81, 0x10, 0xFD, 0x32, 0x00, 0x81, 0xC9]
+
+a = Assembler()
+a.nn(0x31, 0xFFF0)                 # ld sp,0xFFF0
+# copy the RAM code to 0x9000
+a.nn(0x21, 'ram')                  # ld hl,ram
+a.nn(0x11, 0x9000)                 # ld de,0x9000
+a.nn(0x01, len(ram))               # ld bc,len(ram)
+a.label('copy')
+a.db(0x7E, 0x12)                   # ld a,(hl) ; ld (de),a
+a.db(0x23, 0x13, 0x0B)             # inc hl ; inc de ; dec bc
+a.db(0x78, 0xB1)                   # ld a,b ; or c
+a.jr(0x20, 'copy')                 # jr nz,copy
+a.db(0x3E, 0x00)                   # ld a,0
+a.nn(0x32, 0x8100)                 # ld (0x8100),a
+a.label('round')
+# fill 0xA000-0xA0FF with a pattern
+a.nn(0x21, 0xA000)                 # ld hl,0xA000
+a.db(0x06, 0x00)                   # ld b,0
+a.nn(0x3A, 0x8100)                 # ld a,(0x8100)
+a.label('fill')
+a.db(0x77, 0x23, 0xC6, 0x07)       # ld (hl),a ; inc hl ; add a,7
+a.jr(0x10, 'fill')                 # djnz fill
+# and add it up in DE
+a.nn(0x21, 0xA000)                 # ld hl,0xA000
+a.db(0x06, 0x00)                   # ld b,0
+a.nn(0x11, 0x0000)                 # ld de,0
+a.label('sum')
+a.db(0x7E, 0x83, 0x5F)             # ld a,(hl) ; add a,e ; ld e,a
+a.db(0x7A, 0xCE, 0x00, 0x57)       # ld a,d ; adc a,0 ; ld d,a
+a.db(0x23)                         # inc hl
+a.jr(0x10, 'sum')                  # djnz sum
+a.db(0xD5)                         # push de
+a.nn(0xCD, 'multiply')             # call multiply
+a.db(0xD1)                         # pop de
+# run the RAM code, then patch its immediate
+a.nn(0xCD, 0x9000)                 # call 0x9000
+a.nn(0x3A, 0x9001)                 # ld a,(0x9001)
+a.db(0x3C)                         # inc a
+a.nn(0x32, 0x9001)                 # ld (0x9001),a
+# the sum as a letter
+a.db(0x7B, 0xE6, 0x0F, 0xC6, 0x41) # ld a,e ; and 0x0F ; add a,'A'
+a.out(0x20)
+a.nn(0x3A, 0x8100)                 # ld a,(0x8100)
+a.db(0x3C)                         # inc a
+a.nn(0x32, 0x8100)                 # ld (0x8100),a
+a.db(0xFE, 0x00)                   # cp 0
+a.nn(0xC2, 'round')                # jp nz,round
+a.out(0x20, 0x0A)
+a.nn(0xC3, 'round')                # jp round
+
+# 16 * DE into 0x8102
+a.label('multiply')
+a.db(0xC5, 0xE5)                   # push bc ; push hl
+a.nn(0x21, 0x0000)                 # ld hl,0
+a.db(0x06, 0x10)                   # ld b,16
+a.label('add')
+a.db(0x19)                         # add hl,de
+a.jr(0x10, 'add')                  # djnz add
+a.nn(0x22, 0x8102)                 # ld (0x8102),hl
+a.db(0xE1, 0xC1, 0xC9)             # pop hl ; pop bc ; ret
+
+a.label('ram')
+a.db(*ram)
+open(sys.argv[1], 'wb').write(a.done())
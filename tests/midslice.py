@@ -0,0 +1,72 @@
+# Programs the CTC and then the timer well inside a slice and prints,
+# as two hex digits each, how many 35 cycle loops ran until the first
+# interrupt came in
+import sys
+from asm import Assembler
+
+a = Assembler()
+a.nn(0xC3, 'start')                # jp start
+a.pad(0x40)
+a.label('start')
+a.nn(0x31, 0xFFF0)                 # ld sp,0xFFF0
+a.db(0x3E, 0x3F, 0xED, 0x47)       # ld a,0x3F ; ld i,a
+a.db(0xED, 0x5E)                   # im 2
+# over 1000 cycles into the first slice
+a.db(0x06, 80)                     # ld b,80
+a.label('settle')
+a.jr(0x10, 'settle')               # djnz settle
+# CTC channel 0, vector 0, every 16 * 10 cycles
+a.out(0x40, 0x00)
+a.out(0x40, 0x85)
+a.out(0x40, 10)
+a.nn(0xCD, 'measure')              # call measure
+# timer, vector 0x10, every 100 cycles
+a.out(0x11, 100)
+a.out(0x12, 0)
+a.out(0x13, 0)
+a.out(0x14, 0x10)
+a.out(0x10, 1)
+a.nn(0xCD, 'measure')              # call measure
+a.db(0xF3, 0x76)                   # di ; halt
+
+a.label('measure')
+a.nn(0x21, 0x0000)                 # ld hl,0
+a.db(0xAF)                         # xor a
+a.nn(0x32, 0x8000)                 # ld (0x8000),a
+a.db(0xFB)                         # ei
+a.label('wait')
+a.db(0x23)                         # inc hl
+a.nn(0x3A, 0x8000)                 # ld a,(0x8000)
+a.db(0xB7)                         # or a
+a.jr(0x28, 'wait')                 # jr z,wait
+a.db(0x7D, 0x0F, 0x0F, 0x0F, 0x0F) # ld a,l ; rrca x4
+a.nn(0xCD, 'hex')                  # call hex
+a.db(0x7D)                         # ld a,l
+a.nn(0xCD, 'hex')                  # call hex
+a.out(0x20, 0x0A)
+a.db(0xC9)                         # ret
+
+a.label('hex')
+a.db(0xE6, 0x0F, 0xC6, 0x90, 0x27) # and 0x0F ; add a,0x90 ; daa
+a.db(0xCE, 0x40, 0x27)             # adc a,0x40 ; daa
+a.out(0x20)
+a.db(0xC9)                         # ret
+
+# both stop their device, one interrupt is all it takes
+a.label('ctc')
+a.db(0xF5)                         # push af
+a.out(0x40, 0x03)                  # channel 0 reset
+a.label('flag')
+a.db(0x3E, 0x01)                   # ld a,1
+a.nn(0x32, 0x8000)                 # ld (0x8000),a
+a.db(0xF1, 0xFB, 0xED, 0x4D)       # pop af ; ei ; reti
+a.label('timer')
+a.db(0xF5)                         # push af
+a.out(0x10, 0x00)
+a.nn(0xC3, 'flag')                 # jp flag
+
+a.pad(0x3F00)
+a.dw('ctc')
+a.pad(0x3F10)
+a.dw('timer')
+open(sys.argv[1], 'wb').write(a.done(0x4000))
@@ -0,0 +1,51 @@
+# Counts in a loop of plain, indexed and block instructions, halting
+# every fourth time round, while the timer interrupts it. The handler
+# prints the count as two hex digits and stops after 200 interrupts.
+# Where each interrupt lands shows in the output.
+import sys
+from asm import Assembler
+
+a = Assembler()
+a.nn(0xC3, 'start')                # jp start
+a.pad(0x38)
+a.label('isr')
+a.db(0xF5, 0xE5)                   # push af ; push hl
+a.nn(0x3A, 0x8100)                 # ld a,(0x8100)
+a.db(0x0F, 0x0F, 0x0F, 0x0F)       # rrca x4
+a.nn(0xCD, 'hex')                  # call hex
+a.nn(0x3A, 0x8100)                 # ld a,(0x8100)
+a.nn(0xCD, 'hex')                  # call hex
+a.nn(0x21, 0x8102)                 # ld hl,0x8102
+a.db(0x34, 0x7E, 0xFE, 200)        # inc (hl) ; ld a,(hl) ; cp 200
+a.jr(0x20, 'return')               # jr nz,return
+a.out(0x20, 0x0A)
+a.db(0xF3, 0x76)                   # di ; halt
+a.label('return')
+a.db(0xE1, 0xF1, 0xFB, 0xC9)       # pop hl ; pop af ; ei ; ret
+
+a.label('hex')
+a.db(0xE6, 0x0F, 0xC6, 0x90, 0x27) # and 0x0F ; add a,0x90 ; daa
+a.db(0xCE, 0x40, 0x27)             # adc a,0x40 ; daa
+a.out(0x20)
+a.db(0xC9)                         # ret
+
+a.label('start')
+a.nn(0x31, 0xFFF0)                 # ld sp,0xFFF0
+a.db(0xED, 0x56)                   # im 1
+a.db(0xDD); a.nn(0x21, 0x9100)     # ld ix,0x9100
+a.db(0xFB)                         # ei
+a.label('loop')
+a.nn(0x2A, 0x8100)                 # ld hl,(0x8100)
+a.db(0x23)                         # inc hl
+a.nn(0x22, 0x8100)                 # ld (0x8100),hl
+a.db(0x7D, 0xE6, 0x03)             # ld a,l ; and 3
+a.jr(0x20, 'awake')                # jr nz,awake
+a.db(0x76)                         # halt
+a.label('awake')
+a.db(0xDD, 0x34, 0x01)             # inc (ix+1)
+a.nn(0x21, 0x0000)                 # ld hl,0
+a.nn(0x11, 0x9000)                 # ld de,0x9000
+a.nn(0x01, 7)                      # ld bc,7
+a.db(0xED, 0xB0)                   # ldir
+a.nn(0xC3, 'loop')                 # jp loop
+open(sys.argv[1], 'wb').write(a.done(0x4000))
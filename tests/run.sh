@@ -0,0 +1,73 @@
+#!/bin/sh
+# ./tests/run.sh [emulator, default ./pix80emu]
+# Builds the test ROMs with python3 and checks what the emulator makes of them
+# (bench.py and banks.py make the benchmark ROMs, for ./pix80emu -m -n 200000000)
+EMU=${1:-./pix80emu}
+TESTS=$(dirname "$0")
+ROMS=$(mktemp -d)
+trap 'rm -rf "$ROMS"' EXIT
+FAILED=0
+
+# everything but what depends on the host
+run() {
+	"$EMU" "$@" 2>&1 | grep -av '^Loading ROM\|^Throughput\|^Fast core\|^JIT\|^Block instructions' | sed 's/, Wall time.*//'
+}
+
+# expect <name> <serial output> <emulator arguments>
+expect() {
+	NAME=$1
+	EXPECTED=$2
+	shift 2
+	ACTUAL=$("$EMU" "$@" 2>/dev/null | grep -v '^Loading ROM')
+	if [ "$ACTUAL" = "$EXPECTED" ]; then
+		echo "ok   $NAME"
+	else
+		echo "FAIL $NAME: got" $ACTUAL", expected" $EXPECTED
+		FAILED=1
+	fi
+}
+
+# same <name> <reference> <emulator arguments>, the serial output and
+# the counts at exit have to be the reference's
+same() {
+	NAME=$1
+	EXPECTED=$2
+	shift 2
+	ACTUAL=$(run "$@")
+	if [ "$ACTUAL" = "$EXPECTED" ]; then
+		echo "ok   $NAME"
+	else
+		echo "FAIL $NAME: differs from -t"
+		FAILED=1
+	fi
+}
+
+python3 "$TESTS/midslice.py" "$ROMS/midslice.bin" || exit 1
+python3 "$TESTS/periodic.py" "$ROMS/periodic.bin" || exit 1
+
+# A device programmed in the middle of a slice interrupts one period
+# later, not at the end of the slice
+for CORE in "" -t "-c fast" -j; do
+	expect "midslice ${CORE:-default}" "04
+03" -m -n 100000 $CORE "$ROMS/midslice.bin"
+done
+
+# An interrupt raised in the middle of an instruction is taken right
+# after it on every core, as with -t, which ticks one cycle at a time
+TICKED=$(run -m -n 3000000 -I 397 -t "$ROMS/periodic.bin")
+for CORE in "" "-c fast" -j -B; do
+	same "periodic ${CORE:-default}" "$TICKED" -m -n 3000000 -I 397 $CORE "$ROMS/periodic.bin"
+done
+
+# -n stops on the tick it's given, here in the middle of a HALT
+for CORE in "" -t "-c fast" -j; do
+	TICKS=$(run -m -n 30000 -I 2003 $CORE "$ROMS/periodic.bin" | grep '^Ticks')
+	if [ "$TICKS" = "Ticks: 30000, Instructions: 4082" ]; then
+		echo "ok   ticks ${CORE:-default}"
+	else
+		echo "FAIL ticks ${CORE:-default}: $TICKS"
+		FAILED=1
+	fi
+done
+
+exit $FAILED
@@ -0,0 +1,40 @@
+# python3 z80goto.py include/z80.h > z80_goto.h
+# Writes z80_tick() from the chips z80.h with a computed goto in place of
+# its switch on cpu->step, for ./compile.sh -g. The steps are taken from
+# the switch as it is, so this keeps working across upstream updates.
+import re
+import sys
+
+source = open(sys.argv[1]).read()
+
+# the helper macros z80_tick() uses, up to the #undefs after it
+start = source.index('// pin helper macros\n')
+end = source.index('#endif // CHIPS_IMPL', start)
+code = source[start:end]
+
+head, switch = code.split('    switch (cpu->step) {\n', 1)
+body, tail = switch.split('        default: _Z80_UNREACHABLE;\n    }\n', 1)
+
+steps = [int(step) for step in re.findall(r'^ *case +(\d+) *:', body, re.M)]
+if steps != list(range(len(steps))):
+	sys.exit('z80goto.py: the steps in z80_tick() aren\'t numbered 0 to n')
+body = re.sub(r'^( *)case +(\d+) *:', r'\1_z80_step_\2:', body, flags=re.M)
+
+# 32 bit offsets from step 0 keep the table as small as the switch's own
+offsets = ['_z80_step(%d)' % step for step in steps]
+table = ',\n'.join('        ' + ', '.join(offsets[i:i + 8]) for i in range(0, len(offsets), 8))
+dispatch = '''    #define _z80_step(n) (int32_t)((const char*)&&_z80_step_##n - (const char*)&&_z80_step_0)
+    static const int32_t steps[%d] = {
+%s
+    };
+    #undef _z80_step
+    if (cpu->step >= %d) {
+        CHIPS_ASSERT(cpu->step < %d);
+        return pins;
+    }
+    goto *((const char*)&&_z80_step_0 + steps[cpu->step]);
+    {
+''' % (len(steps), table, len(steps), len(steps))
+
+sys.stdout.write('// Made by z80goto.py from %s, don\'t edit\n' % sys.argv[1])
+sys.stdout.write(head + dispatch + body + '    }\n' + tail)